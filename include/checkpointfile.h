@@ -0,0 +1,64 @@
+//----------------------------------------------------------------------
+// Binary Checkpoint File Written and Read with MPI-IO
+//----------------------------------------------------------------------
+#ifndef checkpointfile_h
+#define checkpointfile_h
+//----------------------------------------------------------------------
+#include <stdint.h>
+#include <vector>
+#include <mpi.h>
+//----------------------------------------------------------------------
+// Layout: the header, the particle number of every unit of the writer
+// (int64_t each, in unit id order), then the particles of all units in
+// the same order. The particle k of the whole system is thus found at a
+// fixed offset, whatever the grid of the job reading it.
+//----------------------------------------------------------------------
+struct CheckpointHeader {
+  char magic[8];
+  int32_t version;
+  int32_t num_units;
+  int64_t num_particles;
+  double L[3];
+  double time;
+  double zeta;
+  // Since version 2: the progress of the project (see MDManager::SetPhase)
+  int64_t step;
+  int64_t phase_step;
+  int32_t phase;
+  // Number of the next frame of MDManager::SaveAsCdviewSequential
+  int32_t frame;
+};
+//----------------------------------------------------------------------
+struct CheckpointRecord {
+  double q[3];
+  double p[3];
+  int32_t type;
+  int32_t reserved;
+};
+//----------------------------------------------------------------------
+class CheckpointFile {
+private:
+  MPI_File fh;
+  MPI_Comm comm;
+  bool opened;
+  MPI_Offset data_offset;
+  // Version 1 headers end before step
+  static MPI_Offset GetHeaderSize(int version);
+  // Records are counted in elements, not in bytes
+  MPI_Datatype record_type;
+public:
+  static const int VERSION = 2;
+  CheckpointFile(const char *filename, bool write, MPI_Comm comm_ = MPI_COMM_WORLD);
+  ~CheckpointFile(void);
+  bool IsOpened(void) {return opened;};
+  // Collective. Only rank 0 writes the header.
+  void WriteHeader(CheckpointHeader &header, std::vector<int64_t> &counts);
+  // Version 1 files are read with step, phase_step, phase and frame set to 0
+  bool ReadHeader(CheckpointHeader &header, std::vector<int64_t> &counts);
+  // Collective. index is the position of the first record in the system.
+  void WriteRecords(int64_t index, std::vector<CheckpointRecord> &records);
+  void ReadRecords(int64_t index, int64_t number, std::vector<CheckpointRecord> &records);
+};
+//----------------------------------------------------------------------
+#endif
+//----------------------------------------------------------------------
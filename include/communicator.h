@@ -6,6 +6,8 @@
 #define communicator_h
 #include <mpi.h>
 #include <vector>
+#include <algorithm>
+#include <stdint.h>
 #include "mdconfig.h"
 
 namespace Communicator {
@@ -17,21 +19,67 @@ template <class C>void SendRecvVector(C &send_buffer, int send_number, int dest_
   recv_buffer.resize(recv_number);
   MPI_Sendrecv(&send_buffer[0], send_number * sizeof(send_buffer[0]), MPI_BYTE, dest_rank, 0, &recv_buffer[0], recv_number * sizeof(recv_buffer[0]), MPI_DOUBLE, src_rank, 0, MPI_COMM_WORLD, &st);
 }
+// Contiguous type of the given size, so that counts are element numbers
+MPI_Datatype CreateBlockType(size_t bytes);
+// Aborts if an element number does not fit in the int of MPI
+void CheckElementNumber(int64_t number, const char *where);
+// Personalized exchange: send_number[r] elements of send_buffer, in rank order, go to rank r
+template <class C>void AllToAllVector(std::vector<C> &send_buffer, std::vector<int> &send_number, std::vector<C> &recv_buffer, int num_procs, MPI_Comm comm = MPI_COMM_WORLD) {
+  std::vector<int> recv_number(num_procs);
+  MPI_Alltoall(&send_number[0], 1, MPI_INT, &recv_number[0], 1, MPI_INT, comm);
+  std::vector<int> send_disp(num_procs), recv_disp(num_procs);
+  int64_t send_sum = 0;
+  int64_t recv_sum = 0;
+  for (int r = 0; r < num_procs; r++) {
+    send_sum += send_number[r];
+    recv_sum += recv_number[r];
+  }
+  CheckElementNumber(std::max(send_sum, recv_sum), "AllToAllVector");
+  send_disp[0] = recv_disp[0] = 0;
+  for (int r = 1; r < num_procs; r++) {
+    send_disp[r] = send_disp[r - 1] + send_number[r - 1];
+    recv_disp[r] = recv_disp[r - 1] + recv_number[r - 1];
+  }
+  recv_buffer.resize(recv_sum);
+  MPI_Datatype type = CreateBlockType(sizeof(C));
+  MPI_Alltoallv(send_buffer.empty() ? NULL : &send_buffer[0], &send_number[0], &send_disp[0], type,
+                recv_buffer.empty() ? NULL : &recv_buffer[0], &recv_number[0], &recv_disp[0], type, comm);
+  MPI_Type_free(&type);
+}
 
 double GetTime(void);
 double FindMaxDouble(double value);
+int FindMaxInteger(int value, MPI_Comm comm = MPI_COMM_WORLD);
+int64_t FindMinInteger64(int64_t value, MPI_Comm comm = MPI_COMM_WORLD);
 bool AllReduceBoolean(bool flag);
 double AllReduceDouble(double value);
 void AllReduceDoubleBuffer(double *sendbuf, int size, double *recvbuf);
 int AllReduceInteger(int value);
 unsigned long int AllReduceUnsignedLongInteger(unsigned long int value);
-void AllGatherInteger(int *sendbuf, int number, int *recvbuf);
+void AllGatherInteger(int *sendbuf, int number, int *recvbuf, MPI_Comm comm = MPI_COMM_WORLD);
 void AllGatherDouble(double *sendbuf, int number, double *recvbuf);
 void AllGatherIntegerVector(std::vector<int> &send_buffer, std::vector<int> &recv_buffer, int num_procs);
 void AllGatherUCharVector(std::vector<unsigned char> &send_buffer, std::vector<unsigned char> &recv_buffer, int num_procs);
-void GatherIntegerVector(std::vector<int> &send_buffer, std::vector<int> &recv_buffer, int num_procs, int root);
-void GatherUCharVector(std::vector<unsigned char> &send_buffer, std::vector<unsigned char> &recv_buffer, int num_procs, int root);
+void GatherIntegerVector(std::vector<int> &send_buffer, std::vector<int> &recv_buffer, int num_procs, int root, MPI_Comm comm = MPI_COMM_WORLD);
+void GatherIntegerVectorV(std::vector<int> &send_buffer, std::vector<int> &recv_buffer, int num_procs, int root, MPI_Comm comm = MPI_COMM_WORLD);
+void AllGatherIntegerVectorV(std::vector<int> &send_buffer, std::vector<int> &recv_buffer, int num_procs, MPI_Comm comm = MPI_COMM_WORLD);
+void GatherUCharVector(std::vector<unsigned char> &send_buffer, std::vector<unsigned char> &recv_buffer, int num_procs, int root, MPI_Comm comm = MPI_COMM_WORLD);
 void BroadcastInteger(int &value, int root);
+// Nonblocking point-to-point for the per-unit exchange
+void ISendBytes(void *buf, int size, int dest_rank, int tag, MPI_Request &req);
+void IRecvBytes(void *buf, int size, int src_rank, int tag, MPI_Request &req);
+void WaitAll(int number, MPI_Request *req);
+void IAllReduceDoubleBuffer(double *sendbuf, int size, double *recvbuf, MPI_Request &req);
+int GetTagUpperBound(void);
+bool Test(MPI_Request &req);
+// Per element: the sum over the lower ranks (offset) and over all ranks (total)
+void ScanCounts(std::vector<int64_t> &count, std::vector<int64_t> &offset, std::vector<int64_t> &total, MPI_Comm comm = MPI_COMM_WORLD);
+// Collective: the buffers of all ranks are written to one file in rank order
+bool WriteOrderedBytes(const char *filename, std::vector<char> &buffer, MPI_Comm comm = MPI_COMM_WORLD);
+// Communicator private to a progress or snapshot thread
+MPI_Comm DuplicateWorld(void);
+void FreeComm(MPI_Comm &comm);
+void Progress(MPI_Comm comm);
 
 };
 #endif
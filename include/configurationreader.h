@@ -0,0 +1,59 @@
+//----------------------------------------------------------------------
+// Parallel Reader of External Configurations
+//----------------------------------------------------------------------
+#ifndef configurationreader_h
+#define configurationreader_h
+//----------------------------------------------------------------------
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "checkpointfile.h"
+//----------------------------------------------------------------------
+// The file is memory-mapped by every rank, and each rank parses only
+// its share: a byte range of the lines of a text file (cut at line
+// starts, then split among the threads), or a range of the particles
+// of a trajectory frame. Positions are returned relative to the lower
+// corner of the box, and the caller routes them to their units.
+//
+// CDVIEW: "id type x y z [vx vy vz]" per line, '#' lines skipped.
+// LAMMPS: the first frame of a text dump ("ITEM: ATOMS" with type,
+// x/xu/xs/xsu, ... and optionally vx vy vz), orthogonal boxes only.
+// TRAJECTORY: a frame of the binary trajectory container, any codec.
+//----------------------------------------------------------------------
+class ConfigurationReader {
+private:
+  int fd;
+  const char *data;
+  int64_t size;
+  int format;
+  int frame;
+  int num_threads;
+  bool has_velocity;
+  bool has_box;
+  int64_t expected;
+  double L[3];
+  std::string error;
+  bool ReadCdview(int rank, int num_procs, std::vector<CheckpointRecord> &records);
+  bool ReadLammps(int rank, int num_procs, std::vector<CheckpointRecord> &records);
+  bool ReadTrajectory(int rank, int num_procs, std::vector<CheckpointRecord> &records);
+public:
+  enum {UNKNOWN = -1, CDVIEW, LAMMPS, TRAJECTORY, CHECKPOINT};
+  // name: cdview, lammps, trajectory, checkpoint, or auto (by the extension)
+  static int GetFormat(const std::string &filename, const std::string &name);
+  static const char * GetName(int format);
+  // frame: frame of a trajectory, negative from the last one
+  ConfigurationReader(const char *filename, int format_, int frame_, int num_threads_);
+  ~ConfigurationReader(void);
+  // Collective: the LAMMPS reader agrees on the end of the first frame
+  bool Read(int rank, int num_procs, std::vector<CheckpointRecord> &records);
+  bool IsOpened(void) {return data != NULL;};
+  bool HasVelocity(void) {return has_velocity;};
+  bool HasBox(void) {return has_box;};
+  const double * GetBox(void) {return L;};
+  // Total particle number given by the file, or -1
+  int64_t GetExpectedNumber(void) {return expected;};
+  const std::string & GetError(void) {return error;};
+};
+//----------------------------------------------------------------------
+#endif
+//----------------------------------------------------------------------
@@ -0,0 +1,33 @@
+//----------------------------------------------------------------------
+// Dynamic Load Balancing by Moving Unit Boundaries
+//----------------------------------------------------------------------
+#ifndef loadbalancer_h
+#define loadbalancer_h
+//----------------------------------------------------------------------
+#include <vector>
+#include "mdconfig.h"
+#include "mdrect.h"
+#include "parainfo.h"
+#include "parameter.h"
+#include "simulationinfo.h"
+//----------------------------------------------------------------------
+// The unit grid is kept rectilinear: along each axis the boundaries
+// between unit slabs are shared planes, stored as fractions of the
+// system size. Every unit thus keeps exactly one neighbour per
+// direction, and the existing particle exchange is unchanged.
+class LoadBalancer {
+private:
+  int grid_size[D];
+  std::vector<double> planes[D];
+  double damping;
+  double imbalance;
+  bool BalanceAxis(const int d, const std::vector<double> &slab_work, SimulationInfo *sinfo);
+public:
+  LoadBalancer(ParaInfo *pinfo, Parameter &param);
+  bool Balance(const std::vector<double> &work, ParaInfo *pinfo, SimulationInfo *sinfo);
+  MDRect GetRect(int id, ParaInfo *pinfo, SimulationInfo *sinfo);
+  double GetImbalance(void) {return imbalance;};
+};
+//----------------------------------------------------------------------
+#endif
+//----------------------------------------------------------------------
@@ -30,6 +30,7 @@ constexpr int WARP_SIZE = 32;
 
 const double CUTOFF_LENGTH = 3.0;
 //const double CUTOFF_LENGTH = 2.5;
+const double BUFFER_LENGTH = 0.3;
 
 //---------------------------------------------------------------------------
 extern const char *MDACP_VERSION;
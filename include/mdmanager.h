@@ -2,18 +2,122 @@
 #ifndef mdmanager_h
 #define mdmanager_h
 #include <vector>
+#include <string>
+#include <mpi.h>
 #include "mdunit.h"
 #include "parainfo.h"
+#include "loadbalancer.h"
 #include "simulationinfo.h"
 #include "parameter.h"
+#include "progressthread.h"
+#include "checkpointfile.h"
+#include "snapshotwriter.h"
+#include "trajectorywriter.h"
+//----------------------------------------------------------------------
+// Thrown by Calculate once all ranks agreed to stop and the restart
+// checkpoint is written. Caught by ProjectManager.
+struct StopRequest {
+  int step;
+  double time;
+};
 //----------------------------------------------------------------------
 class MDManager {
 private:
   int num_threads;
+  int num_units;
   int num_procs;
   int rank;
   ParaInfo *pinfo;
   SimulationInfo *sinfo;
+  LoadBalancer *balancer;
+  int load_balance_interval;
+  int step;
+  // Phase of the project and the step at which it began (see SetPhase)
+  int phase;
+  int phase_step;
+  bool pairlist_made;
+  // Units are processed in unit_order, heaviest first with WorkStealing
+  bool work_stealing;
+  std::vector<int> unit_order;
+  std::vector<double> work_mark;
+  std::vector<double> balance_mark;
+  void UpdateUnitOrder(void);
+  // Persistent parallel region: per-unit results read by a single thread
+  bool persistent_region;
+  std::vector<char> unit_expired;
+  std::vector<double> unit_energy;
+  double region_temperature;
+  // Global pair-list expiry found by the check closing the last step
+  bool expiry_ready;
+  bool expiry_global;
+  bool IsAnyUnitExpired(void);
+  double TemperatureInRegion(void);
+  void CalculateInRegion(const int n);
+  // Must be called by all threads of an enclosing parallel region
+  void SendParticlesInRegion(void);
+  void MakePairListInRegion(void);
+  void SendBorderParticlesInRegion(void);
+  void SendBorderMomentaInRegion(void);
+  void ExchangeBorderParticles(const int dir);
+  void DistributeParticles(std::vector<CheckpointRecord> &records);
+  int FindUnit(const double x[3], const double ul[D], const int grid_size[D]);
+  // OverlapInteriorPairs: within a rebuild, the pairs of own particles
+  // are searched while the ghosts are exchanged
+  bool overlap_interior_pairs;
+  void MakePairListOverlapped(void);
+  void ExchangeBorderMomenta(const int dir);
+  // Per-unit exchange under MPI_THREAD_MULTIPLE (4 requests, 2 counts per unit)
+  bool thread_multiple;
+  std::vector<MPI_Request> unit_requests;
+  std::vector<int> unit_counts;
+  int GetUnitTag(const int local_id, const int dir, const int kind);
+  void PostUnitCounts(const int i, const int dir, const int send_number);
+  void PostUnitParticles(const int i, const int dir, std::vector<ParticleInfo> &send_buffer);
+  void SendParticlesPerUnit(const int dir);
+  void ExchangeBorderParticlesPerUnit(const int dir);
+  void ExchangeBorderMomentaPerUnit(const int dir);
+  // NonblockingReduction: expired units, kinetic energy and particle number
+  bool overlap_reduction;
+  bool reduction_pending;
+  bool reduction_ready;
+  double reduction_local[3];
+  double reduction_global[3];
+  MPI_Request reduction_request;
+  void StartStepReduction(void);
+  void FinishStepReduction(void);
+  void DiscardStepReduction(void);
+  // Overlap achieved by the nonblocking reductions
+  double reduction_post_time;
+  int reduction_steps;
+  int reduction_completed;
+  double reduction_window;
+  double reduction_wait;
+  // ProgressThread: enters MPI while the OpenMP threads compute
+  ProgressThread *progress;
+  // AsyncSnapshot: snapshots are processed by a thread of their own
+  SnapshotWriter *snapshot_writer;
+  // Trajectory: SaveAsCdviewSequential appends frames to one container
+  TrajectoryWriter *trajectory;
+  // Number of the next conf file of SaveAsCdviewSequential, kept by checkpoints
+  int cdview_frame;
+  // Stop on a signal (StopSignals) or before the end of WallTime. The
+  // ranks agree every stop_check_interval steps, which is 0 without
+  // either. CheckpointInterval adds periodic checkpoints.
+  int stop_check_interval;
+  double wall_time;
+  double wall_time_margin;
+  double start_wall_time;
+  double check_wall_time;
+  int checkpoint_interval;
+  int checkpoint_keep;
+  std::string checkpoint_file;
+  int checked_step;
+  int GetStepsToCheck(void);
+  void CheckStop(void);
+  double GetReducedTemperature(void) {return reduction_global[1] / reduction_global[2] / 1.5;};
+  bool IsBalanceStep(void) {
+    return load_balance_interval > 0 && step > 0 && step % load_balance_interval == 0;
+  };
   std::vector<MDUnit *> mdv;
   Parameter param;
   // For Grid Management
@@ -26,7 +130,10 @@ private:
   int openmp_grid_size[D];
   bool IsMyUnit(int id);
   int GetLocalID(int id);
+  int GetUnitRank(int id) {return id / num_units;};
   bool IsPairListExpired(void);
+  // Half-shell mode needs no ghosts from the lower z neighbour (D_UP stage)
+  int GetBorderDirections(void) {return sinfo->HalfShell ? D_UP : MAX_DIR;};
   double s_time;
 #ifdef USE_GPU
   double tgpu_per_tcpu = 1.0;
@@ -41,15 +148,19 @@ public:
   MDUnit * GetMDUnit(int index) {return mdv[index];};
   int GetRank(void) {return rank;};
   int GetTotalThreads(void) {return num_threads;};
-  int GetTotalUnits(void) {return num_threads * num_procs;};
+  int GetUnitsPerRank(void) {return num_units;};
+  int GetTotalUnits(void) {return num_units * num_procs;};
   int GetTotalProcs(void) {return num_procs;};
   void GetGridSize(int g[D]) {pinfo->GetGridSize(g);};
+  int GetUnitID(int pos[D]) {return pinfo->Pos2ID(pos);};
+  void GetUnitPosition(int id, int pos[D]) {pinfo->GetGridPosition(id, pos);};
   double * GetSystemSize(void) {return sinfo->L;};
   double GetTimeStep(void) {return sinfo->TimeStep;};
 
 
   //For MDUnit
   void Calculate(void);
+  void CalculateSteps(const int n);
   void CalculateForce(void);
   void CalculateNoseHoover(void);
   void CalculateLangevin(void);
@@ -57,12 +168,31 @@ public:
   void SaveConfiguration(void);
   void SaveAsCdviewSequential(void);
   void SaveAsCdview(const char *filename);
+  // keep > 0: written aside and rotated in (see CheckpointSnapshotTask)
+  void SaveCheckpoint(const char *filename, int keep = 0);
+  // resume: also restores the step, the phase and the frame number (Restart=yes)
+  bool LoadCheckpoint(const char *filename, bool resume = false);
+  bool LoadInitialConfiguration(double v0);
+  void TakeSnapshot(Snapshot &s);
+  // Runs the task at once, or on the snapshot thread with AsyncSnapshot
+  void SubmitSnapshot(SnapshotTask *task, bool owned = false);
+  void FlushSnapshots(void);
+  bool IsAsyncSnapshot(void) {return snapshot_writer != NULL;};
   void SendParticlesSub(const int dir);
   void SendParticles(void);
   void MakePairList(void);
   void SendBorderParticles(void);
-  void SendBorderParticlesSub(const int dir);
+  void UpdateBorderParticles(void);
+  void SendBorderMomenta(void);
   void ExecuteAll(Executor *ex);
+  void BalanceLoad(void);
+
+  // Progress of the project, saved in checkpoints. A project numbers
+  // its stages from 0, calls SetPhase as it enters each, and on restart
+  // skips the stages before GetPhase and the steps already taken in it.
+  int GetPhase(void) {return phase;};
+  int GetStepsInPhase(void) {return step - phase_step;};
+  void SetPhase(int p) {phase = p; phase_step = step;};
 
   //For Observe
   double GetSimulationTime(void) {return s_time;};
@@ -74,6 +204,8 @@ public:
   double Temperature(void);
   double ConfigurationTemperature(void);
   double Pressure(void);
+  ThermoSnapshot TakeThermoSnapshot(void);
+  void RecordObservables(const char *tag, ThermoSnapshot &ts);
 
   // Misc
   void SetControlTemperature(bool b) {sinfo->ControlTemperature = b;};
@@ -41,6 +41,17 @@ public:
   };
   double * GetStartPosition(void) {return s;};
   bool IsOverBoundary(int dir, double q[D]);
+  // Bits 0-2: q < s along x,y,z. Bits 3-5: q >= e along x,y,z.
+  int GetOverBoundaryMask(const double q[D]) {
+    return (q[X] < s[X]) | ((q[Y] < s[Y]) << 1) | ((q[Z] < s[Z]) << 2) |
+           ((q[X] >= e[X]) << 3) | ((q[Y] >= e[Y]) << 4) | ((q[Z] >= e[Z]) << 5);
+  };
+  static int GetMigrationDir(const int mask) {
+    if (mask & 0x09) return (mask & 0x01) ? D_LEFT : D_RIGHT;
+    if (mask & 0x12) return (mask & 0x02) ? D_BACK : D_FORWARD;
+    if (mask & 0x24) return (mask & 0x04) ? D_DOWN : D_UP;
+    return -1;
+  };
   void ChangeScale(double alpha);
 };
 //----------------------------------------------------------------------
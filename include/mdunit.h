@@ -3,6 +3,8 @@
 #define mdunit_h
 #include <stdio.h>
 #include <vector>
+#include <string>
+#include <omp.h>
 #ifdef USE_GPU
 #include <cuda_runtime.h>
 #endif
@@ -15,6 +17,7 @@
 #include "meshlist.h"
 #include "pairlist.h"
 #include "observer.h"
+#include "thermosnapshot.h"
 #include "fcalculator.h"
 //----------------------------------------------------------------------
 class MDUnit;
@@ -33,7 +36,10 @@ private:
   PairList *plist;
   const int id;
   std::vector<int> border_particles[MAX_DIR];
+  std::vector<int> border_candidates[MAX_DIR];
+  int ghost_range[MAX_DIR][2];
   MDRect myrect;
+  double work_time;
 #ifdef USE_GPU
   cudaStream_t strm = 0;
   int pn_gpu = 0;
@@ -42,11 +48,18 @@ public:
   MDUnit (int id_, SimulationInfo *si, ParaInfo *pi);
   ~MDUnit(void);
   std::vector<ParticleInfo> send_buffer;
+  std::vector<double> momentum_buffer;
+  // Receive buffers of the per-unit exchange
+  std::vector<ParticleInfo> recv_buffer;
+  std::vector<double> momentum_recv_buffer;
+  std::vector<ParticleInfo> migration_buffer[MAX_DIR];
   int GetID(void) {return id;};
   MDRect * GetRect(void) {return &myrect;};
+  void SetRect(MDRect &r);
+  double GetWorkTime(void) {return work_time;};
   Variables *GetVariables(void) {return vars;};
   void SaveConfiguration(void);
-  void SaveAsCdview(std::ofstream &ofs);
+  void SaveAsCdview(std::string &buffer);
   void AddParticle(double x[D], double v[D], int type = 1);
   void AddParticle(double x[D], int type = 1);
   double * GetSystemSize(void) {return sinfo->L;};
@@ -56,7 +69,11 @@ public:
   int GetTotalParticleNumber(void) {return vars->GetTotalParticleNumber();};
   void SetTotalParticleNumber(int n) {vars->SetTotalParticleNumber(n);};
 
-  void CalculateForce(void) {ForceCalculator::CalculateForce(vars, mesh, sinfo);};
+  void CalculateForce(void) {
+    const double t = omp_get_wtime();
+    ForceCalculator::CalculateForce(vars, mesh, sinfo);
+    work_time += omp_get_wtime() - t;
+  };
   void UpdatePositionHalf(void) {ForceCalculator::UpdatePositionHalf(vars, sinfo);};
   void HeatbathZeta(double t) {ForceCalculator::HeatbathZeta(vars, t, sinfo);};
   void HeatbathMomenta(void) {ForceCalculator::HeatbathMomenta(vars, sinfo);};
@@ -88,16 +105,24 @@ public:
   };
 #endif
 
-  void MakeBufferForSendingParticle(const int dir);
+  void MakeBufferForMigration(void);
+  void FindBorderCandidates(void) {mesh->FindBorderCandidates(vars, sinfo, myrect, border_candidates);};
   void FindBorderParticles(const int dir);
   void MakeBufferForBorderParticles(const int dir);
-  void ReceiveParticles(std::vector<ParticleInfo> &recv_buffer);
+  void ReceiveMigratingParticles(const int dir, std::vector<ParticleInfo> &recv_buffer);
   void AdjustPeriodicBoundary(void) {vars->AdjustPeriodicBoundary(sinfo);};
-  void ReceiveBorderParticles(std::vector<ParticleInfo> &recv_buffer);
+  void ReceiveBorderParticles(const int dir, std::vector<ParticleInfo> &recv_buffer);
+  int GetBorderParticleNumber(const int dir) {return border_particles[dir].size();};
+  void MakeBufferForBorderMomenta(const int dir);
+  void ReceiveBorderMomenta(const int dir, const double *recv_buffer);
   double ObserveDouble(DoubleObserver *obs) {return obs->Observe(vars, mesh);};
+  void Observe(ThermoSnapshot &snap) {snap.Observe(vars, mesh);};
   int IntegerDouble(IntegerObserver *obs) {return obs->Observe(vars, mesh);};
   void Execute(Executor *ex) {ex->Execute(this);};
   void MakePairList(void);
+  void PrepareInteriorPairList(void);
+  void MakeInteriorPairList(void);
+  void MakeBorderPairList(void);
   void ShowPairs(void) {mesh->ShowPairs();};
   bool IsPairListExpired(void) {return plist->IsPairListExpired(vars, mesh, sinfo);};
   //
@@ -31,6 +31,14 @@ private:
   int * mesh_index;
   int * mesh_index2;
   int * mesh_particle_number;
+  // Sparse mesh: only occupied cells, in increasing cell index
+  bool sparse;
+  std::vector<int> cell_key;
+  std::vector<int> cell_start;
+  std::vector<int> cell_number;
+  std::vector<std::pair<int, int> > cell_sort;
+  inline bool FindCell(int index, int &mi, int &in);
+  void MakeSparseMesh(const int pn);
   int sortbuf[N];
 
 #ifdef USE_GPU
@@ -49,11 +57,19 @@ private:
   int number_of_mesh;
 
   int number_of_constructions;
+  bool half_shell;
+  // Skip pairs of own particles (second stage of OverlapInteriorPairs)
+  bool border_only;
+  int ghost_range[MAX_DIR][2];
+  inline bool IsPairingGhost(int i);
+  inline bool IsSearchPair(int i1, int i2, int pn);
   inline void RegisterPair(int index1, int index2);
   inline void RegisterInteractPair(const double q[][D], int index1, int index2, const double S2);
   int sort_interval;
 
   void MakeListMesh(Variables *vars, SimulationInfo *sinfo, MDRect &myrect);
+  void SearchAllMesh(Variables *vars, SimulationInfo *sinfo);
+  void MakeSortedList(const int pn);
   void MakeMesh(Variables *vars, SimulationInfo *sinfo, MDRect &myrect);
   inline void index2pos(int index, int &ix, int &iy, int &iz);
   inline int pos2index(int ix, int iy, int iz);
@@ -65,6 +81,8 @@ public:
   ~MeshList(void);
 
   void ChangeScale(SimulationInfo *sinfo, MDRect &myrect);
+  bool IsHalfShell(void) {return half_shell;};
+  void SetGhostRange(int range[MAX_DIR][2]);
 
   enum {
     KEY = 0,
@@ -96,6 +114,10 @@ public:
   void ClearNumberOfConstructions(void) {number_of_constructions = 0;};
 
   void MakeList(Variables *vars, SimulationInfo *sinfo, MDRect &myrect);
+  void MakeInteriorList(Variables *vars, SimulationInfo *sinfo);
+  void MakeBorderList(Variables *vars, SimulationInfo *sinfo, MDRect &myrect);
+  void FindBorderCandidates(Variables *vars, SimulationInfo *sinfo, MDRect &myrect,
+                            std::vector<int> candidates[MAX_DIR]);
   void MakeListBruteforce(Variables *vars, SimulationInfo *sinfo, MDRect &myrect);
   void ShowPairs(void);
   void ShowSortedList(Variables *vars);
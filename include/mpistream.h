@@ -3,28 +3,55 @@
 #define mpistream_h
 //----------------------------------------------------------------------
 #include <iostream>
+#include <fstream>
 #include <sstream>
 #include <string>
+#include <vector>
+//----------------------------------------------------------------------
+// Output of rank 0, on the standard output and, once a log file is
+// opened, streamed to it with a flush at most every flush_interval
+// seconds. The other ranks discard their output. Observables may also be
+// written as structured records (CSV or JSON lines).
 //----------------------------------------------------------------------
 class MPIStream {
 private:
   int rank;
   std::ostringstream oss;
-  std::ostringstream os_backup;
+  std::ofstream log;
+  std::ofstream records;
+  int record_format;
+  // Columns of the last CSV header
+  std::string record_header;
+  std::vector<std::string> keys;
+  std::vector<double> values;
+  double flush_interval;
+  double last_flush;
+  void FlushIfDue(void);
 public:
+  enum {CSV, JSON};
   MPIStream(void) {
     rank = 0;
+    record_format = CSV;
+    flush_interval = 1.0;
+    last_flush = 0.0;
+  };
+  ~MPIStream(void) {
+    Flush();
   };
   void SetRank(int r) {rank = r;};
+  void SetFlushInterval(double sec) {flush_interval = sec;};
+  bool OpenLog(const std::string &filename, bool append);
+  bool OpenRecords(const std::string &filename, int format);
+  void Flush(void);
   template <class T>
   MPIStream & operator << (const T&a) {
-    oss << a;
-    os_backup << a;
+    if (0 == rank) oss << a;
     return *this;
   }
   MPIStream & operator << (std::ostream & (*pf)(std::ostream &));
-  void SaveToFile(std::string filename);
-  void AppendToFile(std::string filename);
+  // Adds a field to the current record, which EndRecord writes
+  MPIStream & Field(const char *key, double value);
+  void EndRecord(const char *tag);
 };
 //----------------------------------------------------------------------
 extern MPIStream mout;
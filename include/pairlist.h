@@ -3,6 +3,7 @@
 //----------------------------------------------------------------------
 #ifndef pairlist_h
 #define pairlist_h
+#include <vector>
 #include "mdconfig.h"
 #include "meshlist.h"
 #include "variables.h"
@@ -15,7 +16,21 @@ private:
   double buffer_length;
   double qb_old[N][D];
   double disp[N];
+  struct CandidateCell {
+    int ix, iy, iz;
+    int index;
+    bool operator<(const CandidateCell &c) const {
+      if (iz != c.iz) return iz < c.iz;
+      if (iy != c.iy) return iy < c.iy;
+      if (ix != c.ix) return ix < c.ix;
+      return index < c.index;
+    }
+  };
+  std::vector<int> candidates;
+  std::vector<CandidateCell> cells;
 
+  double CalculateDisplacement(const int pn, double q[N][D]);
+  bool HasNewNeighbor(double q[N][D], SimulationInfo *sinfo);
   bool CheckByDisplacement(Variables *vars, MeshList *mesh, SimulationInfo *sinfo);
   void UpdatePairListValidity(const int pn, double p[N][D], SimulationInfo *sinfo);
   static bool Compare(const int &i, const int &j);
@@ -19,6 +19,9 @@ private:
   void SetGrid(void);
   void ReadGlobalGrid(Parameter &param);
   void ReadLocalGrid(Parameter &param);
+  void OptimizeGrid(Parameter &param);
+  double GetBoxLength(Parameter &param, int d);
+  double GhostVolume(const double w[D], const bool exchanged[D], bool half_shell);
   bool valid;
   static const int diff[MAX_DIR][D];
 public:
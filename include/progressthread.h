@@ -0,0 +1,32 @@
+//----------------------------------------------------------------------
+// Thread Driving the Progress of Nonblocking MPI Communication
+//----------------------------------------------------------------------
+#ifndef progressthread_h
+#define progressthread_h
+//----------------------------------------------------------------------
+#include <atomic>
+#include <thread>
+#include <mpi.h>
+//----------------------------------------------------------------------
+// Requests posted by the OpenMP threads complete only while some thread
+// is inside the MPI library. This thread enters it periodically, so that
+// they complete during the computation. Requires MPI_THREAD_MULTIPLE.
+// The requests left outstanding across computation are those of the
+// NonblockingReduction; the halo and migration exchanges are waited on
+// right after they are posted, so they gain little from it.
+class ProgressThread {
+private:
+  MPI_Comm comm;
+  std::thread thread;
+  std::atomic<bool> running;
+  int interval;
+  std::atomic<unsigned long int> polls;
+  void Loop(void);
+public:
+  ProgressThread(int interval_us);
+  ~ProgressThread(void);
+  unsigned long int GetPolls(void) {return polls.load();};
+};
+//----------------------------------------------------------------------
+#endif
+//----------------------------------------------------------------------
@@ -24,6 +24,8 @@ public:
   double AimedTemperature;
   bool ControlTemperature;
   bool SortParticle;
+  bool HalfShell;
+  bool SparseMesh;
   std::string BaseDir;
   double SearchLength;
   double BufferLength;
@@ -0,0 +1,112 @@
+//----------------------------------------------------------------------
+// Asynchronous Snapshot Output and In-situ Analysis
+//----------------------------------------------------------------------
+#ifndef snapshotwriter_h
+#define snapshotwriter_h
+//----------------------------------------------------------------------
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <mpi.h>
+#include "checkpointfile.h"
+//----------------------------------------------------------------------
+// Copy of the own particles of the units of a rank, in local unit order
+//----------------------------------------------------------------------
+struct Snapshot {
+  double L[3];
+  double time;
+  double zeta;
+  // Progress of the project, kept by checkpoints
+  int step;
+  int phase_step;
+  int phase;
+  int frame;
+  std::vector<int> counts;
+  // Start position of each unit, 3 per unit
+  std::vector<double> origins;
+  std::vector<CheckpointRecord> records;
+};
+//----------------------------------------------------------------------
+// Work done on a snapshot. Process is collective over comm, and may run
+// on the snapshot thread while the integrator continues, so it must not
+// write to mout. Returns false on failure.
+//----------------------------------------------------------------------
+class SnapshotTask {
+public:
+  virtual ~SnapshotTask(void) {};
+  virtual bool Process(Snapshot &s, MPI_Comm comm) = 0;
+};
+//----------------------------------------------------------------------
+// Same text layout as MDManager::SaveAsCdview
+class CdviewSnapshotTask : public SnapshotTask {
+private:
+  std::string filename;
+public:
+  CdviewSnapshotTask(const char *f) : filename(f) {};
+  bool Process(Snapshot &s, MPI_Comm comm);
+};
+//----------------------------------------------------------------------
+// Binary checkpoint file, also written by MDManager::SaveCheckpoint.
+// With keep > 0, the file is written under a temporary name and then
+// rotated in: filename is the newest, filename.1 ... filename.<keep-1>
+// the older ones. A job killed while writing leaves them intact.
+class CheckpointSnapshotTask : public SnapshotTask {
+private:
+  std::string filename;
+  int keep;
+  int64_t total;
+  std::string GetRotatedName(int index);
+public:
+  CheckpointSnapshotTask(const char *f, int keep_ = 0) : filename(f), keep(keep_), total(0) {};
+  bool Process(Snapshot &s, MPI_Comm comm);
+  int64_t GetTotalParticleNumber(void) {return total;};
+};
+//----------------------------------------------------------------------
+// One thread per rank processes the submitted snapshots in order, with a
+// communicator of its own. The staging buffers are recycled, and a
+// submission waits while all of them are queued. Requires
+// MPI_THREAD_MULTIPLE.
+class SnapshotWriter {
+private:
+  struct Job {
+    Snapshot *snapshot;
+    SnapshotTask *task;
+    bool owned;
+  };
+  MPI_Comm comm;
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::deque<Job> queue;
+  std::vector<Snapshot *> buffers;
+  std::vector<Snapshot *> free_buffers;
+  bool running;
+  bool working;
+  // Exposed: staging copies and waits for a buffer or a flush.
+  // Hidden: work of the thread not waited for.
+  int submitted;
+  int failed;
+  double acquired_time;
+  double stage_time;
+  double stall_time;
+  double work_time;
+  void Loop(void);
+public:
+  SnapshotWriter(int num_buffers);
+  ~SnapshotWriter(void);
+  Snapshot *Acquire(void);
+  // The task is deleted after processing if owned
+  void Submit(Snapshot *s, SnapshotTask *task, bool owned);
+  void Flush(void);
+  int GetSubmitted(void) {return submitted;};
+  int GetFailed(void) {return failed;};
+  double GetStageTime(void) {return stage_time;};
+  double GetStallTime(void) {return stall_time;};
+  double GetWorkTime(void) {return work_time;};
+};
+//----------------------------------------------------------------------
+#endif
+//----------------------------------------------------------------------
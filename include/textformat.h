@@ -0,0 +1,18 @@
+//----------------------------------------------------------------------
+// Fast Float-to-text Conversion for Text Snapshots
+//----------------------------------------------------------------------
+#ifndef textformat_h
+#define textformat_h
+//----------------------------------------------------------------------
+#include <string>
+//----------------------------------------------------------------------
+namespace TextFormat {
+// Same text as printf("%g"). buffer must hold 32 characters.
+// Returns the length, without a terminating null.
+int General(double value, char *buffer);
+// Appends the cdview line "0 type q[0] q[1] q[2] p[0] p[1] p[2]\n"
+void AppendCdviewLine(std::string &buffer, int type, const double *q, const double *p);
+}
+//----------------------------------------------------------------------
+#endif
+//----------------------------------------------------------------------
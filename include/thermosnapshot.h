@@ -0,0 +1,43 @@
+//----------------------------------------------------------------------
+// Thermodynamic Snapshot
+//----------------------------------------------------------------------
+#ifndef thermosnapshot_h
+#define thermosnapshot_h
+//----------------------------------------------------------------------
+#include "variables.h"
+#include "meshlist.h"
+//----------------------------------------------------------------------
+// All quantities of an observation line are accumulated in one pass
+// over the particles and one over the pairs of each unit, and reduced
+// with a single collective. The derived quantities are then local.
+//----------------------------------------------------------------------
+class ThermoSnapshot {
+public:
+  static const int MAX_TYPE = 4;
+private:
+  enum {S_KINETIC, S_POTENTIAL, S_VIRIAL, S_NUMBER, S_TYPE, S_SIZE = S_TYPE + MAX_TYPE};
+  double value[S_SIZE];
+  double volume;
+public:
+  ThermoSnapshot(void);
+  void Clear(void);
+  void Observe(Variables *vars, MeshList *mesh);
+  void Add(const ThermoSnapshot &s);
+  void Reduce(void);
+  void SetVolume(double v) {volume = v;};
+  double GetParticleNumber(void) {return value[S_NUMBER];};
+  double GetTypeNumber(int t) {return (t >= 0 && t < MAX_TYPE) ? value[S_TYPE + t] : 0.0;};
+  double KineticEnergy(void) {return value[S_KINETIC] / value[S_NUMBER];};
+  double PotentialEnergy(void) {return value[S_POTENTIAL] / value[S_NUMBER];};
+  double TotalEnergy(void) {return KineticEnergy() + PotentialEnergy();};
+  double Temperature(void) {return KineticEnergy() / 1.5;};
+  double ConfigurationTemperature(void) {return value[S_VIRIAL] / value[S_NUMBER];};
+  double Pressure(void) {
+    const double pn = value[S_NUMBER];
+    const double phi = value[S_VIRIAL] / pn;
+    return (Temperature() - phi) * pn / volume;
+  };
+};
+//----------------------------------------------------------------------
+#endif
+//----------------------------------------------------------------------
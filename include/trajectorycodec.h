@@ -0,0 +1,54 @@
+//----------------------------------------------------------------------
+// Compressed Encodings of the Trajectory Particles
+//----------------------------------------------------------------------
+#ifndef trajectorycodec_h
+#define trajectorycodec_h
+//----------------------------------------------------------------------
+#include <stdint.h>
+#include <vector>
+//----------------------------------------------------------------------
+// The particles of one type of one unit form a chunk, which is encoded
+// and decoded independently. Both codecs sort the particles of a chunk
+// by cell (unit length, relative to the origin of the unit) so that
+// neighbours in the stream are neighbours in space. The order of the
+// particles is thus not kept.
+//
+// QUANTIZED: positions on a grid of precision relative to the origin,
+// momenta on a grid of momentum_precision, so that the error is at most
+// half of the step. Positions are delta-encoded along the stream, and
+// every component is zigzag-coded and bit-packed with its own width.
+//
+// LOSSLESS: every double is XORed with the same component of the
+// previous particle, and only its nonzero low bytes are stored, with a
+// 4-bit byte count per value.
+//----------------------------------------------------------------------
+struct TrajectoryParticle {
+  double q[3];
+  double p[3];
+};
+//----------------------------------------------------------------------
+struct TrajectoryChunk {
+  int64_t num_particles;
+  int64_t bytes;
+  double origin[3];
+  double precision;
+  double momentum_precision;
+  uint8_t width[6];
+  uint8_t reserved[2];
+};
+//----------------------------------------------------------------------
+namespace TrajectoryCodec {
+enum {RAW = 0, QUANTIZED = 1, LOSSLESS = 2};
+const char * GetName(int codec);
+// Returns -1 for an unknown name
+int GetCodec(const char *name);
+// Appends the chunk to out. The particles are sorted in place.
+void Encode(int codec, const double origin[3], double precision, double momentum_precision,
+            std::vector<TrajectoryParticle> &particles, std::vector<char> &out);
+// Appends the particles of the chunk at data. Returns its size in bytes,
+// or -1 if the chunk does not hold its particles within that size.
+int64_t Decode(int codec, const char *data, std::vector<TrajectoryParticle> &particles);
+};
+//----------------------------------------------------------------------
+#endif
+//----------------------------------------------------------------------
@@ -0,0 +1,67 @@
+//----------------------------------------------------------------------
+// Layout of the Binary Trajectory Container
+//----------------------------------------------------------------------
+#ifndef trajectoryfile_h
+#define trajectoryfile_h
+//----------------------------------------------------------------------
+#include <stdint.h>
+//----------------------------------------------------------------------
+// The header is followed by the frames, back to back, and then by the
+// index (one entry per frame). A frame is appended at end_offset, over
+// the old index, and the index and the header are rewritten after it.
+// If a job dies while appending, the frames before end_offset are still
+// found by walking their headers from the first one.
+//
+// A frame is its header, the particle number of each type, the byte size
+// of each type (int64_t each) and the particles grouped by type, type 0
+// first. The particles of one type are thus read without touching the
+// others. With the raw codec a type is an array of TrajectoryRecord,
+// otherwise a sequence of chunks (see trajectorycodec.h).
+//----------------------------------------------------------------------
+struct TrajectoryHeader {
+  char magic[8];
+  int32_t version;
+  int32_t record_size;
+  int64_t num_frames;
+  int64_t index_offset;
+  int64_t end_offset;
+  char reserved[24];
+};
+//----------------------------------------------------------------------
+struct TrajectoryFrameHeader {
+  char magic[8];
+  int64_t frame;
+  int64_t num_particles;
+  int32_t num_types;
+  int32_t codec;
+  double time;
+  double L[3];
+};
+//----------------------------------------------------------------------
+struct TrajectoryRecord {
+  float q[3];
+  float p[3];
+};
+//----------------------------------------------------------------------
+struct TrajectoryIndexEntry {
+  int64_t offset;
+  int64_t num_particles;
+  int64_t bytes;
+  double time;
+  int32_t num_types;
+  int32_t codec;
+};
+//----------------------------------------------------------------------
+namespace TrajectoryFile {
+const int VERSION = 2;
+const int MAX_TYPES = 256;
+const char MAGIC[8] = "MDACPTJ";
+const char FRAME_MAGIC[8] = "MDFRAME";
+// data_bytes: sum of the byte sizes of the types
+inline int64_t FrameSize(int num_types, int64_t data_bytes) {
+  return sizeof(TrajectoryFrameHeader) + 2 * sizeof(int64_t) * num_types + data_bytes;
+}
+};
+//----------------------------------------------------------------------
+#endif
+//----------------------------------------------------------------------
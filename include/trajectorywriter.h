@@ -0,0 +1,53 @@
+//----------------------------------------------------------------------
+// Collective Writer of the Binary Trajectory Container
+//----------------------------------------------------------------------
+#ifndef trajectorywriter_h
+#define trajectorywriter_h
+//----------------------------------------------------------------------
+#include <string>
+#include <vector>
+#include <mpi.h>
+#include "trajectoryfile.h"
+#include "trajectorycodec.h"
+#include "snapshotwriter.h"
+//----------------------------------------------------------------------
+// Appends one frame per snapshot. The particles of each unit and type
+// are encoded in parallel, and every rank writes its part of each type
+// at an offset given by a prefix sum over the ranks. With append, the
+// frames of an existing file are kept. Open must succeed before the
+// first frame.
+class TrajectoryWriter : public SnapshotTask {
+private:
+  std::string filename;
+  bool append;
+  bool opened;
+  int codec;
+  double precision;
+  double momentum_precision;
+  int num_threads;
+  int64_t end_offset;
+  std::vector<TrajectoryIndexEntry> index;
+  // Encoded particles of each unit (outer) and type (inner)
+  std::vector<std::vector<std::vector<char> > > unit_data;
+  // Local statistics: full-precision size (48 bytes per particle),
+  // encoded size and time of the encoding
+  double raw_bytes;
+  double encoded_bytes;
+  double encode_time;
+  bool ReadIndex(MPI_File fh);
+  void EncodeUnit(Snapshot &s, int u, int offset, int num_types);
+public:
+  TrajectoryWriter(const char *f, bool append_, int codec_, double precision_,
+                   double momentum_precision_, int num_threads_);
+  // Collective. False if the file cannot be opened, or cannot be
+  // appended to without losing its contents.
+  bool Open(MPI_Comm comm);
+  bool Process(Snapshot &s, MPI_Comm comm);
+  int GetCodec(void) {return codec;};
+  int GetFrameNumber(void) {return index.size();};
+  double GetCompressionRatio(void) {return (encoded_bytes > 0.0) ? raw_bytes / encoded_bytes : 0.0;};
+  double GetEncodeRate(void) {return (encode_time > 0.0) ? raw_bytes / encode_time * 1e-6 : 0.0;};
+};
+//----------------------------------------------------------------------
+#endif
+//----------------------------------------------------------------------
@@ -1,4 +1,5 @@
 //----------------------------------------------------------------------
+#include <algorithm>
 #include "benchmark.h"
 #include "mpistream.h"
 #include "communicator.h"
@@ -12,42 +13,65 @@ Benchmark bench;
 void
 Benchmark::Run(MDManager *mdm) {
   Parameter *param = mdm->GetParameter();
-  //SimpleConfigurationMaker c(param);
-  ExtractConfigurationMaker c(param);
-  mdm->ExecuteAll(&c);
+  // With Restart=yes, the run goes on from the checkpoint if it exists,
+  // and the final state is written to it as a thermalized state.
+  // Phase 0 thermalizes and phase 1 measures.
+  const bool restart = param->GetBooleanDef("Restart", false);
+  const std::string checkpoint = param->GetStringDef("CheckpointFile", "checkpoint.dat");
+  const bool restarted = restart && mdm->LoadCheckpoint(checkpoint.c_str(), true);
   const double v0 = param->GetDoubleDef("InitialVelocity", 1.0);
-  mdm->SetInitialVelocity(v0);
+  if (!restarted && !mdm->LoadInitialConfiguration(v0)) {
+    //SimpleConfigurationMaker c(param);
+    ExtractConfigurationMaker c(param);
+    mdm->ExecuteAll(&c);
+    mdm->SetInitialVelocity(v0);
+  }
   const int T_LOOP = param->GetIntegerDef("ThermalizeLoop", 150);
   const int LOOP = param->GetIntegerDef("TotalLoop", 1000);
   const int OBSERVE_LOOP = param->GetIntegerDef("ObserveLoop", 100);
   mdm->ShowSystemInformation();
   mdm->MakePairList();
-  for (int i = 0; i < T_LOOP; i++) {
-    mdm->Calculate();
+  if (mdm->GetPhase() == 0) {
+    mdm->CalculateSteps(T_LOOP - mdm->GetStepsInPhase());
+    mdm->SetPhase(1);
   }
+  const int done = std::min(mdm->GetStepsInPhase(), LOOP);
   double start_time = Communicator::GetTime();
 #ifdef FX10
   fipp_start();
 #endif
-  for (int i = 0; i < LOOP; i++) {
-    mdm->Calculate();
-    if (i % OBSERVE_LOOP == 0) {
-      mout << mdm->GetSimulationTime();
-      mout << " " << mdm->Temperature();
-      mout << " " << mdm->Pressure();
-      mout << " " << mdm->TotalEnergy();
-      mout << " #observe" << std::endl;
+  for (int i = 0; i < LOOP; i += OBSERVE_LOOP) {
+    const int n = std::min(OBSERVE_LOOP, LOOP - i);
+    if (done >= i + n) continue;
+    if (done > i) {
+      // Observed before the stop
+      mdm->CalculateSteps(i + n - done);
+      continue;
     }
+    mdm->Calculate();
+    ThermoSnapshot ts = mdm->TakeThermoSnapshot();
+    mout << mdm->GetSimulationTime();
+    mout << " " << ts.Temperature();
+    mout << " " << ts.Pressure();
+    mout << " " << ts.TotalEnergy();
+    mout << " #observe" << std::endl;
+    mdm->RecordObservables("observe", ts);
+    mdm->CalculateSteps(n - 1);
   }
 #ifdef FX10
   fipp_stop();
 #endif
   double sec = Communicator::GetTime() - start_time;
   const unsigned long int pn = mdm->GetTotalParticleNumber();
-  double mups = static_cast<double>(LOOP);
+  double mups = static_cast<double>(LOOP - done);
   mups = mups * static_cast<double>(pn) / sec / 1.0e6;
   mout << "# N = " << pn << " ";
   mout << sec << " [SEC] ";
   mout << mups << " [MUPS]" << std::endl;
+  if (restart) {
+    // A restart from it measures again
+    mdm->SetPhase(1);
+    mdm->SaveCheckpoint(checkpoint.c_str());
+  }
 }
 //----------------------------------------------------------------------
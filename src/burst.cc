@@ -103,38 +103,48 @@ public:
 void
 Burst::Run(MDManager *mdm) {
   Parameter *param = mdm->GetParameter();
-  DropletMaker c(param);
-  mdm->ExecuteAll(&c);
   const double v0 = param->GetDoubleDef("InitialVelocity", 1.0);
-  mdm->SetInitialVelocity(v0);
+  if (!mdm->LoadInitialConfiguration(v0)) {
+    DropletMaker c(param);
+    mdm->ExecuteAll(&c);
+    mdm->SetInitialVelocity(v0);
+  }
   const int T_LOOP = param->GetIntegerDef("ThermalizeLoop", 150);
   const int LOOP = param->GetIntegerDef("TotalLoop", 1000);
   const int OBSERVE_LOOP = param->GetIntegerDef("ObserveLoop", 100);
   mdm->ShowSystemInformation();
   mdm->MakePairList();
-  mdm->SetControlTemperature(true);
-  for (int i = 0; i < T_LOOP; i++) {
-    mdm->Calculate();
-    if (i % OBSERVE_LOOP == 0) {
-      mdm->SaveAsCdviewSequential();
+  // Phase 0 thermalizes and phase 1 observes. A restart goes on after
+  // the steps already taken.
+  if (mdm->GetPhase() == 0) {
+    mdm->SetControlTemperature(true);
+    for (int i = mdm->GetStepsInPhase(); i < T_LOOP; i++) {
+      mdm->Calculate();
+      if (i % OBSERVE_LOOP == 0) {
+        mdm->SaveAsCdviewSequential();
+      }
     }
+    mdm->SetPhase(1);
   }
   mdm->SetControlTemperature(false);
+  const int done = mdm->GetStepsInPhase();
   double start_time = Communicator::GetTime();
-  for (int i = 0; i < LOOP; i++) {
+  for (int i = done; i < LOOP; i++) {
     mdm->Calculate();
     if (i % OBSERVE_LOOP == 0) {
+      ThermoSnapshot ts = mdm->TakeThermoSnapshot();
       mout << mdm->GetSimulationTime();
-      mout << " " << mdm->Temperature();
-      mout << " " << mdm->Pressure();
-      mout << " " << mdm->TotalEnergy();
+      mout << " " << ts.Temperature();
+      mout << " " << ts.Pressure();
+      mout << " " << ts.TotalEnergy();
       mout << "# observe" << std::endl;
+      mdm->RecordObservables("observe", ts);
       mdm->SaveAsCdviewSequential();
     }
   }
   double sec = Communicator::GetTime() - start_time;
   const unsigned long int pn = mdm->GetTotalParticleNumber();
-  double mups = static_cast<double>(LOOP);
+  double mups = static_cast<double>(LOOP - done);
   mups = mups * static_cast<double>(pn) / sec / 1.0e6;
   mout << "# N = " << pn << " ";
   mout << sec << " [SEC] ";
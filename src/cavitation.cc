@@ -1,8 +1,16 @@
 //----------------------------------------------------------------------
 #include <vector>
 #include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
 #include <fstream>
 #include <algorithm>
+#include <map>
+#include <unordered_map>
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
 #include "mpistream.h"
 #include "confmaker.h"
 #include "communicator.h"
@@ -11,7 +19,31 @@
 Cavitation cav;
 const double density_threshold = 0.2;
 //----------------------------------------------------------------------
-class BubbleHist {
+// Layout of the compressed density file (DensityCompression=yes):
+// a DensityHeader, one DensityChunk per unit in the order of the unit
+// IDs, then the zlib streams of the chunks. A chunk is the block of
+// cells of a unit, x fastest, with element_bytes per cell.
+//----------------------------------------------------------------------
+struct DensityHeader {
+  char magic[8];
+  int32_t grid[3];
+  int32_t chunk[3];
+  int32_t element_bytes;
+  int32_t num_chunks;
+  int32_t reserved[2];
+};
+//----------------------------------------------------------------------
+struct DensityChunk {
+  int32_t start[3];
+  int32_t reserved;
+  int64_t offset;
+  int64_t bytes;
+};
+//----------------------------------------------------------------------
+// Runs on a snapshot, so that it may overlap the integration. Each rank
+// keeps the cells of its own units and writes them to its blocks of
+// the global grid.
+class BubbleHist : public SnapshotTask {
 private:
   double grid_size;
   int local_grid_x;
@@ -22,148 +54,504 @@ private:
   int global_grid_x;
   int global_grid_y;
   int global_grid_z;
-  std::vector < std::vector<int> > v_index;
-  std::vector < std::vector<unsigned char> > v_data;
-  std::vector <int> global_index;
-  std::vector <unsigned char> global_data;
-  std::vector <unsigned char> global_data_tmp;
-  /*
-    std::vector <bool> clustering_grid;
-    std::vector <int> cluster_number;
-    std::vector <int> cluster_size;
-  */
-  unsigned char threshold;
+  int unit_grid[D];
+  // Global ID of the unit at each position of the unit grid
+  std::vector <int> unit_id;
+  // First global cell of each local unit, 3 per unit
+  std::vector <int> v_start;
+  std::vector < std::vector<unsigned int> > v_data;
+  // Bubble label of each cell of each local unit, -1 for liquid cells
+  std::vector < std::vector<int> > v_label;
+  // Block of each local unit in the global grid
+  std::vector <MPI_Datatype> v_filetype;
+  MPI_Datatype etype;
+  // Bytes per cell in the output, which saturates at the largest value
+  int density_bytes;
+  bool compression;
+  unsigned int threshold;
   int analyse_count;
+  int rank;
+  int num_procs;
+  int num_units;
+  // Threads binning the units; one on the snapshot thread by default
+  int num_threads;
 
 public:
-  BubbleHist(MDManager *mdm, const double gsize) {
-    analyse_count = 0;
-    MDRect * myrect = mdm->GetMDUnit(0)->GetRect();
-    const double wx = myrect->GetWidth(X);
-    const double wy = myrect->GetWidth(Y);
-    const double wz = myrect->GetWidth(Z);
+  // count: number of the first analysis, after those of a stopped run
+  BubbleHist(MDManager *mdm, const double gsize, const int count = 0) {
+    analyse_count = count;
+    rank = mdm->GetRank();
+    num_procs = mdm->GetTotalProcs();
+    num_units = mdm->GetUnitsPerRank();
+    // The blocks follow the uniform decomposition, not the unit rects,
+    // which differ between ranks once LoadBalancer has moved them.
+    // Particles outside the block of their unit go to its owner.
+    mdm->GetGridSize(unit_grid);
+    const double *L = mdm->GetSystemSize();
+    const double wx = L[X] / static_cast<double>(unit_grid[X]);
+    const double wy = L[Y] / static_cast<double>(unit_grid[Y]);
+    const double wz = L[Z] / static_cast<double>(unit_grid[Z]);
     local_grid_x = static_cast<int>(wx / gsize + 0.5);
     local_grid_y = static_cast<int>(wy / gsize + 0.5);
     local_grid_z = static_cast<int>(wz / gsize + 0.5);
-
-    int g[D];
-    mdm->GetGridSize(g);
-    global_grid_x = local_grid_x * g[X];
-    global_grid_y = local_grid_y * g[Y];
-    global_grid_z = local_grid_z * g[Z];
+    global_grid_x = local_grid_x * unit_grid[X];
+    global_grid_y = local_grid_y * unit_grid[Y];
+    global_grid_z = local_grid_z * unit_grid[Z];
 
     grid_size = wx / static_cast<double>(local_grid_x);
-    threshold = static_cast<unsigned char>(grid_size * grid_size * grid_size * density_threshold);
+    threshold = static_cast<unsigned int>(grid_size * grid_size * grid_size * density_threshold);
     local_grid_number = local_grid_x * local_grid_y * local_grid_z;
-    const int num_threads = mdm->GetTotalThreads();
-    const int num_units = mdm->GetTotalUnits();
-    v_data.resize(num_threads);
-    v_index.resize(num_threads);
-    if (0 == mdm->GetRank()) {
-      global_grid_number = local_grid_number * num_units;
-      global_data.resize(global_grid_number);
-      global_data_tmp.resize(global_grid_number);
-      global_index.resize(global_grid_number);
-      /*
-        clustering_grid.resize(global_grid_number);
-        cluster_number.resize(global_grid_number);
-        cluster_size.resize(global_grid_number);
-      */
-    }
-    for (int i = 0; i < num_threads; i++) {
+    global_grid_number = local_grid_number * mdm->GetTotalUnits();
+
+    unit_id.resize(mdm->GetTotalUnits());
+    int pos[D];
+    for (pos[Z] = 0; pos[Z] < unit_grid[Z]; pos[Z]++) {
+      for (pos[Y] = 0; pos[Y] < unit_grid[Y]; pos[Y]++) {
+        for (pos[X] = 0; pos[X] < unit_grid[X]; pos[X]++) {
+          unit_id[pos[X] + (pos[Y] + pos[Z] * unit_grid[Y]) * unit_grid[X]] = mdm->GetUnitID(pos);
+        }
+      }
+    }
+
+    Parameter *param = mdm->GetParameter();
+    num_threads = param->GetIntegerDef("AnalysisThreads",
+                  mdm->IsAsyncSnapshot() ? 1 : mdm->GetTotalThreads());
+    num_threads = std::max(num_threads, 1);
+    density_bytes = param->GetIntegerDef("DensityBytes", 1);
+    if (density_bytes == 2) {
+      etype = MPI_UNSIGNED_SHORT;
+    } else if (density_bytes == 4) {
+      etype = MPI_UNSIGNED;
+    } else {
+      if (density_bytes != 1) {
+        show_warning("DensityBytes must be 1, 2, or 4; 1 is used");
+      }
+      density_bytes = 1;
+      etype = MPI_UNSIGNED_CHAR;
+    }
+    compression = param->GetBooleanDef("DensityCompression", false);
+#ifndef USE_ZLIB
+    if (compression) {
+      show_warning("DensityCompression needs a build with USE_ZLIB; the density is not compressed");
+      compression = false;
+    }
+#endif
+
+    const int sizes[3] = {global_grid_z, global_grid_y, global_grid_x};
+    const int subsizes[3] = {local_grid_z, local_grid_y, local_grid_x};
+    v_data.resize(num_units);
+    v_label.resize(num_units);
+    v_start.resize(num_units * 3);
+    v_filetype.resize(num_units);
+    for (int i = 0; i < num_units; i++) {
       v_data[i].resize(local_grid_number);
-      v_index[i].resize(local_grid_number);
+      v_label[i].resize(local_grid_number);
+      int *s = &v_start[i * 3];
+      mdm->GetUnitPosition(mdm->GetMDUnit(i)->GetID(), pos);
+      s[X] = pos[X] * local_grid_x;
+      s[Y] = pos[Y] * local_grid_y;
+      s[Z] = pos[Z] * local_grid_z;
+      const int starts[3] = {s[Z], s[Y], s[X]};
+      MPI_Type_create_subarray(3, sizes, subsizes, starts, MPI_ORDER_C, etype, &v_filetype[i]);
+      MPI_Type_commit(&v_filetype[i]);
     }
     mout << "# Grid Information ------" << std::endl;
     mout << "# grid_size = " << grid_size << std::endl;
     mout << "# grid: " << global_grid_x << "," << global_grid_y << "," << global_grid_z  << std::endl;
     mout << "# grid_count = " << global_grid_number << std::endl;
+    mout << "# bytes per cell = " << density_bytes << (compression ? " (compressed)" : "") << std::endl;
     mout << "# ------" << std::endl;
 
   };
 
-  void SaveDensity(void) {
+  ~BubbleHist(void) {
+    for (int i = 0; i < num_units; i++) {
+      MPI_Type_free(&v_filetype[i]);
+    }
+  };
+
+  // Cells of unit i in the output element type
+  void Pack(const int i, std::vector<char> &buffer) {
+    buffer.resize(local_grid_number * density_bytes);
+    const unsigned int max_value = (density_bytes == 4) ? 0xffffffffU : ((1U << (8 * density_bytes)) - 1);
+    for (int j = 0; j < local_grid_number; j++) {
+      const unsigned int v = std::min(v_data[i][j], max_value);
+      if (density_bytes == 1) {
+        buffer[j] = static_cast<unsigned char>(v);
+      } else if (density_bytes == 2) {
+        const uint16_t v16 = static_cast<uint16_t>(v);
+        memcpy(&buffer[j * 2], &v16, 2);
+      } else {
+        memcpy(&buffer[j * 4], &v, 4);
+      }
+    }
+  };
+
+  // Every rank writes the blocks of its units through a subarray view
+  bool SaveDensity(MPI_Comm comm) {
     char filename[256];
     sprintf(filename, "conf%04d.dat", analyse_count);
-    std::ofstream ofs(filename);
-    ofs.write((char*)&global_data[0], sizeof(global_data[0]) * (global_data.size()));
+    MPI_File fh;
+    if (MPI_File_open(comm, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+      return false;
+    }
+    MPI_File_set_size(fh, 0);
+    std::vector<char> buffer;
+    for (int i = 0; i < num_units; i++) {
+      Pack(i, buffer);
+      MPI_File_set_view(fh, 0, etype, v_filetype[i], const_cast<char *>("native"), MPI_INFO_NULL);
+      MPI_File_write_all(fh, &buffer[0], local_grid_number, etype, MPI_STATUS_IGNORE);
+    }
+    MPI_File_close(&fh);
+    return true;
   };
 
-  /*
-    void SaveDistribution(void) {
-      char filename[256];
-      std::vector <int> v_dist;
-      v_dist.resize(global_grid_number);
-      for (int i = 0; i < global_grid_number; i++) {
-        v_dist[i] = 0;
-      }
-      for (int i = 0; i < global_grid_number; i++) {
-        v_dist[cluster_size[i]]++;
+#ifdef USE_ZLIB
+  // Each unit is a chunk. The liquid cells hold few distinct values and
+  // the vapour cells are mostly zero, so that the chunks deflate well.
+  bool SaveCompressed(MPI_Comm comm) {
+    std::vector<DensityChunk> chunks(num_units);
+    std::vector<char> data;
+    std::vector<char> buffer;
+    for (int i = 0; i < num_units; i++) {
+      Pack(i, buffer);
+      uLongf bytes = compressBound(buffer.size());
+      const size_t start = data.size();
+      data.resize(start + bytes);
+      if (compress2(reinterpret_cast<Bytef *>(&data[start]), &bytes,
+                    reinterpret_cast<const Bytef *>(&buffer[0]), buffer.size(), Z_BEST_SPEED) != Z_OK) {
+        return false;
       }
-      sprintf(filename, "d%04d.dist", analyse_count);
-      std::ofstream ofs(filename);
-      const double v = grid_size * grid_size * grid_size;
-      for (int i = 1; i <= cluster_size[0]; i++) {
-        if (v_dist[i] != 0) {
-          ofs << v * i << " " << v_dist[i] << std::endl;
-        }
+      data.resize(start + bytes);
+      memset(&chunks[i], 0, sizeof(chunks[i]));
+      for (int d = 0; d < 3; d++) {
+        chunks[i].start[d] = v_start[i * 3 + d];
       }
-    };
-  */
-  void AnalyseSub(MDUnit *mdu, const int index) {
-    double *s = mdu->GetRect()->GetStartPosition();
-    const int sx = static_cast<int>(s[X] / grid_size + 0.5);
-    const int sy = static_cast<int>(s[Y] / grid_size + 0.5);
-    const int sz = static_cast<int>(s[Z] / grid_size + 0.5);
-    for (int i = 0; i < local_grid_number; i++) {
-      const int ix = (i % local_grid_x) + sx;
-      const int iy = ((i / local_grid_x) % local_grid_y) + sy;
-      const int iz = i / local_grid_x / local_grid_y + sz;
-      const int j = ix + iy * global_grid_x + iz * global_grid_x * global_grid_y;
-      v_index[index][i] = j;
+      chunks[i].offset = start;
+      chunks[i].bytes = bytes;
     }
-    for (int i = 0; i < local_grid_number; i++) {
-      v_data[index][i] = 0;
+    std::vector<int64_t> count(1, data.size()), offset, total;
+    Communicator::ScanCounts(count, offset, total, comm);
+    const int64_t data_start = sizeof(DensityHeader) + sizeof(DensityChunk) * num_units * num_procs;
+    for (int i = 0; i < num_units; i++) {
+      chunks[i].offset += data_start + offset[0];
+    }
+
+    char filename[256];
+    sprintf(filename, "conf%04d.dcz", analyse_count);
+    MPI_File fh;
+    if (MPI_File_open(comm, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+      return false;
+    }
+    MPI_File_set_size(fh, 0);
+    if (0 == rank) {
+      DensityHeader header;
+      memset(&header, 0, sizeof(header));
+      memcpy(header.magic, "MDACPDNS", sizeof(header.magic));
+      header.grid[X] = global_grid_x;
+      header.grid[Y] = global_grid_y;
+      header.grid[Z] = global_grid_z;
+      header.chunk[X] = local_grid_x;
+      header.chunk[Y] = local_grid_y;
+      header.chunk[Z] = local_grid_z;
+      header.element_bytes = density_bytes;
+      header.num_chunks = num_units * num_procs;
+      MPI_File_write_at(fh, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    // The IDs of the units of a rank are contiguous
+    const MPI_Offset table = sizeof(DensityHeader) + sizeof(DensityChunk) * rank * num_units;
+    MPI_File_write_at_all(fh, table, &chunks[0], sizeof(DensityChunk) * num_units, MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_File_write_at_all(fh, data_start + offset[0], data.empty() ? NULL : &data[0], data.size(),
+                          MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+    return true;
+  };
+#else
+  bool SaveCompressed(MPI_Comm) {
+    return false;
+  };
+#endif
+  static int Wrap(int i, const int n) {
+    if (i < 0) {
+      i += n;
+    } else if (i >= n) {
+      i -= n;
     }
-    Variables *vars = mdu->GetVariables();
-    const int pn = vars->GetParticleNumber();
-    double (*q)[D] = vars->q;
+    return i;
+  };
+  // Global ID of the unit which owns the cell
+  int GetCellUnit(const int ix, const int iy, const int iz) {
+    const int ux = ix / local_grid_x;
+    const int uy = iy / local_grid_y;
+    const int uz = iz / local_grid_z;
+    return unit_id[ux + (uy + uz * unit_grid[Y]) * unit_grid[X]];
+  };
+  // Counts a cell of a local unit, given by its global index. Indices
+  // outside the blocks of this rank are ignored.
+  void AddCell(const int j) {
+    if (j < 0 || j >= global_grid_number) return;
+    const int ix = j % global_grid_x;
+    const int iy = (j / global_grid_x) % global_grid_y;
+    const int iz = j / global_grid_x / global_grid_y;
+    const int index = GetCellUnit(ix, iy, iz) - rank * num_units;
+    if (index < 0 || index >= num_units) return;
+    const int *s = &v_start[index * 3];
+    v_data[index][(ix - s[X]) + ((iy - s[Y]) + (iz - s[Z]) * local_grid_y) * local_grid_x]++;
+  };
+  // Particles which left the unit since the last migration go to the
+  // overflow list of the rank owning their cell
+  void AnalyseSub(const int index, const CheckpointRecord *r, const int pn,
+                  std::vector<std::vector<int> > &overflow) {
+    std::vector<unsigned int> &data = v_data[index];
+    std::fill(data.begin(), data.end(), 0);
+    const int *s = &v_start[index * 3];
     const double gsinv = 1.0 / grid_size;
     for (int i = 0; i < pn; i++) {
-      const int ix = static_cast<int>((q[i][X] - s[X]) * gsinv);
-      const int iy = static_cast<int>((q[i][Y] - s[Y]) * gsinv);
-      const int iz = static_cast<int>((q[i][Z] - s[Z]) * gsinv);
-      const int local_index = ix + iy * local_grid_x + iz * local_grid_x * local_grid_y;
-      assert(local_index >= 0);
-      assert(local_index < local_grid_number);
-      v_data[index][local_index] ++;
+      const int ix = Wrap(static_cast<int>(floor(r[i].q[X] * gsinv)), global_grid_x);
+      const int iy = Wrap(static_cast<int>(floor(r[i].q[Y] * gsinv)), global_grid_y);
+      const int iz = Wrap(static_cast<int>(floor(r[i].q[Z] * gsinv)), global_grid_z);
+      const int lx = ix - s[X];
+      const int ly = iy - s[Y];
+      const int lz = iz - s[Z];
+      if (lx < 0 || lx >= local_grid_x || ly < 0 || ly >= local_grid_y || lz < 0 || lz >= local_grid_z) {
+        overflow[GetCellUnit(ix, iy, iz) / num_units].push_back(GetIndex(ix, iy, iz));
+        continue;
+      }
+      data[lx + (ly + lz * local_grid_y) * local_grid_x]++;
     }
   };
-  void Analyse(MDManager *mdm) {
-    mdm->MakePairList();
-    const int num_threads = mdm->GetTotalThreads();
-    #pragma omp parallel for schedule(static)
-    for (int i = 0; i < num_threads; i++) {
-      AnalyseSub(mdm->GetMDUnit(i), i);
-    }
-    std::vector<int> v_indextmp;
-    std::vector<unsigned char> v_datatmp;
-    for (int i = 0; i < num_threads; i++) {
-      v_indextmp.insert(v_indextmp.end(), v_index[i].begin(), v_index[i].end());
-      v_datatmp.insert(v_datatmp.end(), v_data[i].begin(), v_data[i].end());
-    }
-    const int num_procs = mdm->GetTotalProcs();
-    Communicator::GatherIntegerVector(v_indextmp, global_index, num_procs, 0);
-    Communicator::GatherUCharVector(v_datatmp, global_data_tmp, num_procs, 0);
-    if (0 == mdm->GetRank()) {
-      for (int i = 0; i < (int)global_index.size(); i++) {
-        global_data[global_index[i]] = global_data_tmp[i];
+  bool Process(Snapshot &snap, MPI_Comm comm) {
+    // The units are binned in parallel, each with overflow lists of its
+    // own, which are then merged in unit order
+    std::vector<int> offset(num_units + 1, 0);
+    for (int i = 0; i < num_units; i++) {
+      offset[i + 1] = offset[i] + snap.counts[i];
+    }
+    std::vector<std::vector<std::vector<int> > > overflow(num_units, std::vector<std::vector<int> >(num_procs));
+    #pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+    for (int i = 0; i < num_units; i++) {
+      AnalyseSub(i, snap.records.data() + offset[i], snap.counts[i], overflow[i]);
+    }
+    std::vector<int> send_buffer;
+    std::vector<int> send_number(num_procs, 0);
+    std::vector<int> recv_buffer;
+    for (int p = 0; p < num_procs; p++) {
+      for (int i = 0; i < num_units; i++) {
+        send_number[p] += overflow[i][p].size();
+        send_buffer.insert(send_buffer.end(), overflow[i][p].begin(), overflow[i][p].end());
       }
-      SaveDensity();
-      //Clastering();
-      //SaveDistribution();
     }
+    Communicator::AllToAllVector(send_buffer, send_number, recv_buffer, num_procs, comm);
+    for (unsigned int i = 0; i < recv_buffer.size(); i++) {
+      AddCell(recv_buffer[i]);
+    }
+    const bool ok = compression ? SaveCompressed(comm) : SaveDensity(comm);
+    std::unordered_map<int, int> parent;
+    Clustering(parent, comm);
+    SaveDistribution(parent, snap.time, comm);
     analyse_count++;
+    return ok;
+  };
+  static int FindRoot(std::vector<int> &parent, int i) {
+    while (parent[i] != i) {
+      parent[i] = parent[parent[i]];
+      i = parent[i];
+    }
+    return i;
+  };
+  // Labels missing from parent are roots
+  static int FindLabel(std::unordered_map<int, int> &parent, const int label) {
+    int i = label;
+    std::unordered_map<int, int>::iterator it = parent.find(i);
+    while (it != parent.end() && it->second != i) {
+      i = it->second;
+      it = parent.find(i);
+    }
+    it = parent.find(label);
+    if (it != parent.end()) it->second = i;
+    return i;
+  };
+  static void UniteLabels(std::unordered_map<int, int> &parent, const int a, const int b) {
+    const int ra = FindLabel(parent, a);
+    const int rb = FindLabel(parent, b);
+    if (ra < rb) {
+      parent[rb] = ra;
+    } else if (rb < ra) {
+      parent[ra] = rb;
+    }
+  };
+  // Vapour cells (at most threshold particles) of a unit, joined with
+  // their neighbours inside the unit. A component is labelled with the
+  // global index of its first cell.
+  void LabelUnit(const int index) {
+    const std::vector<unsigned int> &data = v_data[index];
+    const int nx = local_grid_x;
+    const int nxy = local_grid_x * local_grid_y;
+    std::vector<int> parent(local_grid_number);
+    for (int i = 0; i < local_grid_number; i++) {
+      parent[i] = (data[i] <= threshold) ? i : -1;
+    }
+    for (int i = 0; i < local_grid_number; i++) {
+      if (parent[i] < 0) continue;
+      const int ix = i % nx;
+      const int iy = (i / nx) % local_grid_y;
+      const int iz = i / nxy;
+      const int neighbor[3] = {(ix > 0) ? i - 1 : -1, (iy > 0) ? i - nx : -1, (iz > 0) ? i - nxy : -1};
+      for (int d = 0; d < 3; d++) {
+        const int j = neighbor[d];
+        if (j < 0 || parent[j] < 0) continue;
+        const int ri = FindRoot(parent, i);
+        const int rj = FindRoot(parent, j);
+        parent[std::max(ri, rj)] = std::min(ri, rj);
+      }
+    }
+    const int *s = &v_start[index * 3];
+    std::vector<int> &label = v_label[index];
+    for (int i = 0; i < local_grid_number; i++) {
+      if (parent[i] < 0) {
+        label[i] = -1;
+        continue;
+      }
+      const int r = FindRoot(parent, i);
+      label[i] = GetIndex(r % nx + s[X], (r / nx) % local_grid_y + s[Y], r / nxy + s[Z]);
+    }
+  };
+  // Labels of the layer of a unit normal to d, in a fixed order
+  void GetFace(const int index, const int d, const int layer, std::vector<int> &face) {
+    const int n[3] = {local_grid_x, local_grid_y, local_grid_z};
+    const int a = (d + 1) % 3;
+    const int b = (d + 2) % 3;
+    int c[3];
+    c[d] = layer;
+    for (c[b] = 0; c[b] < n[b]; c[b]++) {
+      for (c[a] = 0; c[a] < n[a]; c[a]++) {
+        face.push_back(v_label[index][c[0] + (c[1] + c[2] * n[1]) * n[0]]);
+      }
+    }
+  };
+  // Every unit sends its lower faces to the units below, which join them
+  // with their upper faces. The joined labels lie on faces only, and all
+  // ranks resolve all of them, so that they agree on the bubble labels.
+  void Clustering(std::unordered_map<int, int> &parent, MPI_Comm comm) {
+    for (int i = 0; i < num_units; i++) {
+      LabelUnit(i);
+    }
+    const int n[3] = {local_grid_x, local_grid_y, local_grid_z};
+    std::vector<std::vector<int> > halo(num_procs);
+    for (int i = 0; i < num_units; i++) {
+      for (int d = 0; d < 3; d++) {
+        int pos[3];
+        for (int k = 0; k < 3; k++) {
+          pos[k] = v_start[i * 3 + k] / n[k];
+        }
+        pos[d] = (pos[d] + unit_grid[d] - 1) % unit_grid[d];
+        const int id = unit_id[pos[0] + (pos[1] + pos[2] * unit_grid[Y]) * unit_grid[X]];
+        std::vector<int> &h = halo[id / num_units];
+        h.push_back(id % num_units);
+        h.push_back(d);
+        GetFace(i, d, 0, h);
+      }
+    }
+    std::vector<int> send_buffer;
+    std::vector<int> send_number(num_procs);
+    std::vector<int> recv_buffer;
+    for (int p = 0; p < num_procs; p++) {
+      send_number[p] = halo[p].size();
+      send_buffer.insert(send_buffer.end(), halo[p].begin(), halo[p].end());
+    }
+    Communicator::AllToAllVector(send_buffer, send_number, recv_buffer, num_procs, comm);
+    std::unordered_map<int, int> local_parent;
+    std::vector<int> face;
+    unsigned int k = 0;
+    while (k < recv_buffer.size()) {
+      const int i = recv_buffer[k++];
+      const int d = recv_buffer[k++];
+      face.clear();
+      GetFace(i, d, n[d] - 1, face);
+      for (unsigned int j = 0; j < face.size(); j++) {
+        if (face[j] >= 0 && recv_buffer[k + j] >= 0) {
+          UniteLabels(local_parent, face[j], recv_buffer[k + j]);
+        }
+      }
+      k += face.size();
+    }
+    std::vector<int> pairs;
+    std::vector<int> all_pairs;
+    for (std::unordered_map<int, int>::iterator it = local_parent.begin(); it != local_parent.end(); ++it) {
+      pairs.push_back(it->first);
+      pairs.push_back(FindLabel(local_parent, it->first));
+    }
+    Communicator::AllGatherIntegerVectorV(pairs, all_pairs, num_procs, comm);
+    parent.clear();
+    for (unsigned int j = 0; j < all_pairs.size(); j += 2) {
+      UniteLabels(parent, all_pairs[j], all_pairs[j + 1]);
+    }
+  };
+  // The sizes of a bubble are summed on the rank owning its label, and
+  // the histograms of the sizes are merged on rank 0, which writes
+  // d%04d.dist and a line of bubble.dat.
+  void SaveDistribution(std::unordered_map<int, int> &parent, const double time, MPI_Comm comm) {
+    std::unordered_map<int, int> local_size;
+    for (int i = 0; i < num_units; i++) {
+      for (int j = 0; j < local_grid_number; j++) {
+        if (v_label[i][j] >= 0) local_size[v_label[i][j]]++;
+      }
+    }
+    std::vector<std::vector<int> > part(num_procs);
+    for (std::unordered_map<int, int>::iterator it = local_size.begin(); it != local_size.end(); ++it) {
+      const int l = FindLabel(parent, it->first);
+      const int ix = l % global_grid_x;
+      const int iy = (l / global_grid_x) % global_grid_y;
+      const int iz = l / global_grid_x / global_grid_y;
+      std::vector<int> &p = part[GetCellUnit(ix, iy, iz) / num_units];
+      p.push_back(l);
+      p.push_back(it->second);
+    }
+    std::vector<int> send_buffer;
+    std::vector<int> send_number(num_procs);
+    std::vector<int> recv_buffer;
+    for (int p = 0; p < num_procs; p++) {
+      send_number[p] = part[p].size();
+      send_buffer.insert(send_buffer.end(), part[p].begin(), part[p].end());
+    }
+    Communicator::AllToAllVector(send_buffer, send_number, recv_buffer, num_procs, comm);
+    std::unordered_map<int, int> size;
+    for (unsigned int j = 0; j < recv_buffer.size(); j += 2) {
+      size[recv_buffer[j]] += recv_buffer[j + 1];
+    }
+    std::map<int, int> hist;
+    for (std::unordered_map<int, int>::iterator it = size.begin(); it != size.end(); ++it) {
+      hist[it->second]++;
+    }
+    std::vector<int> local_hist;
+    std::vector<int> all_hist;
+    for (std::map<int, int>::iterator it = hist.begin(); it != hist.end(); ++it) {
+      local_hist.push_back(it->first);
+      local_hist.push_back(it->second);
+    }
+    Communicator::GatherIntegerVectorV(local_hist, all_hist, num_procs, 0, comm);
+    if (0 != rank) return;
+    hist.clear();
+    for (unsigned int j = 0; j < all_hist.size(); j += 2) {
+      hist[all_hist[j]] += all_hist[j + 1];
+    }
+    const double v = grid_size * grid_size * grid_size;
+    char filename[256];
+    sprintf(filename, "d%04d.dist", analyse_count);
+    std::ofstream ofs(filename);
+    int number = 0;
+    double volume = 0.0;
+    for (std::map<int, int>::iterator it = hist.begin(); it != hist.end(); ++it) {
+      ofs << v * it->first << " " << it->second << std::endl;
+      number += it->second;
+      volume += v * it->first * it->second;
+    }
+    const double largest = hist.empty() ? 0.0 : v * hist.rbegin()->first;
+    std::ofstream bfs("bubble.dat", (analyse_count == 0) ? std::ios::out : std::ios::app);
+    if (analyse_count == 0) {
+      bfs << "# time number_of_bubbles largest_volume vapour_volume" << std::endl;
+    }
+    bfs << time << " " << number << " " << largest << " " << volume << std::endl;
   };
   int GetIndex(int ix, int iy, int iz) {
     if (ix < 0) {
@@ -183,103 +571,68 @@ public:
     }
     return ix + iy * global_grid_x + iz * global_grid_x * global_grid_y;
   };
-  /*
-    int GetClusterIndex(int index) {
-      while (index != cluster_number[index]) {
-        index = cluster_number[index];
-      }
-      return index;
-    };
-    void Check(int ix1, int iy1, int iz1, int ix2, int iy2, int iz2) {
-      const int i1 = GetIndex(ix1, iy1, iz1);
-      const int i2 = GetIndex(ix2, iy2, iz2);
-      assert(i1 < global_grid_number);
-      assert(i2 < global_grid_number);
-      if (!clustering_grid[i1] || !clustering_grid[i2]) {
-        return;
-      }
-      int c1 = GetClusterIndex(i1);
-      int c2 = GetClusterIndex(i2);
-      if (c1 < c2) {
-        cluster_number[c2] = c1;
-      } else {
-        cluster_number[c1] = c2;
-      }
-    };
-    void Clastering(void) {
-      for (int i = 0; i < global_grid_number; i++) {
-        clustering_grid[i] = (global_data[i] <= threshold);
-        cluster_number[i] = i;
-        cluster_size[i] = 0;
-      }
-      for (int iz = 0; iz < global_grid_z; iz++) {
-        for (int iy = 0; iy < global_grid_y; iy++) {
-          for (int ix = 0; ix < global_grid_x; ix++) {
-            Check(ix, iy, iz, ix + 1, iy  , iz);
-            Check(ix, iy, iz, ix  , iy + 1, iz);
-            Check(ix, iy, iz, ix  , iy  , iz + 1);
-          }
-        }
-      }
-      for (int i = 0; i < global_grid_number; i++) {
-        const int index = GetClusterIndex(i);
-        cluster_size[index]++;
-      }
-      std::sort(cluster_size.begin(), cluster_size.end(), std::greater<int>());
-    };
-    double GetMaxClusterSize(MDManager *mdm) {
-      if (mdm->GetRank() != 0) return 0.0;
-      const double v = grid_size * grid_size * grid_size;
-      return cluster_size[0] * v;
-    };
-  */
 };
 //----------------------------------------------------------------------
 void
 Cavitation::Run(MDManager *mdm) {
   Parameter *param = mdm->GetParameter();
-  ExtractConfigurationMaker c(param);
-  mdm->ExecuteAll(&c);
   const double v0 = param->GetDoubleDef("InitialVelocity", 1.0);
-  mdm->SetInitialVelocity(v0);
+  if (!mdm->LoadInitialConfiguration(v0)) {
+    ExtractConfigurationMaker c(param);
+    mdm->ExecuteAll(&c);
+    mdm->SetInitialVelocity(v0);
+  }
   const int T_LOOP = param->GetIntegerDef("ThermalizeLoop", 150);
   const int LOOP = param->GetIntegerDef("TotalLoop", 1000);
   const int OBSERVE_LOOP = param->GetIntegerDef("ObserveLoop", 100);
-  mdm->SetControlTemperature(true);
-  mdm->ShowSystemInformation();
+  // Phase 0 thermalizes. Phase 1 starts with the expansion, which a
+  // restart finds already applied to the system of the checkpoint.
   double t1 = MPI_Wtime();
-  for (int i = 0; i < T_LOOP; i++) {
+  if (mdm->GetPhase() == 0) {
+    mdm->SetControlTemperature(true);
+    mdm->ShowSystemInformation();
+  }
+  const int first = (mdm->GetPhase() == 0) ? mdm->GetStepsInPhase() : T_LOOP;
+  for (int i = first; i < T_LOOP; i++) {
     mdm->Calculate();
     if (i % OBSERVE_LOOP == 0) {
+      ThermoSnapshot ts = mdm->TakeThermoSnapshot();
       mout << mdm->GetSimulationTime();
-      mout << " " << mdm->Temperature();
-      mout << " " << mdm->PotentialEnergy();
-      mout << " " << mdm->Pressure();
-      mout << " " << mdm->TotalEnergy();
+      mout << " " << ts.Temperature();
+      mout << " " << ts.PotentialEnergy();
+      mout << " " << ts.Pressure();
+      mout << " " << ts.TotalEnergy();
       mout << " " << MPI_Wtime() - t1;
       mout << " # Thermalize" << std::endl;
+      mdm->RecordObservables("thermalize", ts);
     }
   }
   const double CHANGE_SCALE = param->GetDoubleDef("ChangeScale", 1.05);
   const double GRID_SIZE = param->GetDoubleDef("GridSize", 3.0);
-  mdm->ChangeScale(CHANGE_SCALE);
+  if (mdm->GetPhase() == 0) {
+    mdm->ChangeScale(CHANGE_SCALE);
+    mdm->SetPhase(1);
+  }
   mdm->SetControlTemperature(false);
-  BubbleHist bhist(mdm, GRID_SIZE);
+  const int done = mdm->GetStepsInPhase();
+  BubbleHist bhist(mdm, GRID_SIZE, (done + OBSERVE_LOOP - 1) / OBSERVE_LOOP);
   mdm->ShowSystemInformation();
-  for (int i = 0; i <= LOOP; i++) {
+  for (int i = done; i <= LOOP; i++) {
     mdm->Calculate();
     if (i % OBSERVE_LOOP == 0) {
-      bhist.Analyse(mdm);
+      mdm->UpdateBorderParticles();
+      mdm->SubmitSnapshot(&bhist);
+      ThermoSnapshot ts = mdm->TakeThermoSnapshot();
       mout << mdm->GetSimulationTime();
-      mout << " " << mdm->Temperature();
-      mout << " " << mdm->PotentialEnergy();
-      mout << " " << mdm->Pressure();
-      mout << " " << mdm->TotalEnergy();
+      mout << " " << ts.Temperature();
+      mout << " " << ts.PotentialEnergy();
+      mout << " " << ts.Pressure();
+      mout << " " << ts.TotalEnergy();
       mout << " " << MPI_Wtime() - t1;
       mout << " # Observe" << std::endl;
+      mdm->RecordObservables("observe", ts);
     }
   }
-  const std::string filename = param->GetStringDef("OutputFile", "std.out");
-  mout.SaveToFile(filename.c_str());
+  mdm->FlushSnapshots();
 }
 //----------------------------------------------------------------------
@@ -0,0 +1,93 @@
+//----------------------------------------------------------------------
+// Binary Checkpoint File Written and Read with MPI-IO
+//----------------------------------------------------------------------
+#include <stddef.h>
+#include <string.h>
+#include "communicator.h"
+#include "checkpointfile.h"
+//----------------------------------------------------------------------
+static const char CHECKPOINT_MAGIC[8] = "MDACPCK";
+//----------------------------------------------------------------------
+CheckpointFile::CheckpointFile(const char *filename, bool write, MPI_Comm comm_) {
+  comm = comm_;
+  const int mode = write ? (MPI_MODE_CREATE | MPI_MODE_WRONLY) : MPI_MODE_RDONLY;
+  // File errors are returned by default, so that a missing file is not fatal
+  opened = (MPI_File_open(comm, const_cast<char *>(filename), mode,
+                          MPI_INFO_NULL, &fh) == MPI_SUCCESS);
+  if (opened && write) {
+    MPI_File_set_size(fh, 0);
+  }
+  data_offset = 0;
+  record_type = Communicator::CreateBlockType(sizeof(CheckpointRecord));
+}
+//----------------------------------------------------------------------
+CheckpointFile::~CheckpointFile(void) {
+  if (opened) MPI_File_close(&fh);
+  MPI_Type_free(&record_type);
+}
+//----------------------------------------------------------------------
+MPI_Offset
+CheckpointFile::GetHeaderSize(int version) {
+  return (version == 1) ? offsetof(CheckpointHeader, step) : sizeof(CheckpointHeader);
+}
+//----------------------------------------------------------------------
+void
+CheckpointFile::WriteHeader(CheckpointHeader &header, std::vector<int64_t> &counts) {
+  memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+  header.version = VERSION;
+  header.num_units = counts.size();
+  data_offset = sizeof(CheckpointHeader) + sizeof(int64_t) * counts.size();
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  if (rank != 0) return;
+  MPI_File_write_at(fh, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+  MPI_File_write_at(fh, sizeof(header), &counts[0], sizeof(int64_t) * counts.size(),
+                    MPI_BYTE, MPI_STATUS_IGNORE);
+}
+//----------------------------------------------------------------------
+bool
+CheckpointFile::ReadHeader(CheckpointHeader &header, std::vector<int64_t> &counts) {
+  MPI_Status st;
+  int n = 0;
+  MPI_File_read_at(fh, 0, &header, sizeof(header), MPI_BYTE, &st);
+  MPI_Get_count(&st, MPI_BYTE, &n);
+  if (n < static_cast<int>(GetHeaderSize(1))) return false;
+  if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0) return false;
+  if (header.version < 1 || header.version > VERSION || header.num_units <= 0) return false;
+  const MPI_Offset header_size = GetHeaderSize(header.version);
+  if (n < header_size) return false;
+  if (header.version == 1) {
+    header.step = 0;
+    header.phase_step = 0;
+    header.phase = 0;
+    header.frame = 0;
+  }
+  counts.resize(header.num_units);
+  MPI_File_read_at(fh, header_size, &counts[0], sizeof(int64_t) * counts.size(),
+                   MPI_BYTE, MPI_STATUS_IGNORE);
+  int64_t sum = 0;
+  for (unsigned int i = 0; i < counts.size(); i++) {
+    sum += counts[i];
+  }
+  if (sum != header.num_particles) return false;
+  data_offset = header_size + sizeof(int64_t) * counts.size();
+  return true;
+}
+//----------------------------------------------------------------------
+void
+CheckpointFile::WriteRecords(int64_t index, std::vector<CheckpointRecord> &records) {
+  const MPI_Offset offset = data_offset + index * sizeof(CheckpointRecord);
+  Communicator::CheckElementNumber(records.size(), "CheckpointFile::WriteRecords");
+  MPI_File_write_at_all(fh, offset, records.empty() ? NULL : &records[0],
+                        static_cast<int>(records.size()), record_type, MPI_STATUS_IGNORE);
+}
+//----------------------------------------------------------------------
+void
+CheckpointFile::ReadRecords(int64_t index, int64_t number, std::vector<CheckpointRecord> &records) {
+  Communicator::CheckElementNumber(number, "CheckpointFile::ReadRecords");
+  records.resize(number);
+  const MPI_Offset offset = data_offset + index * sizeof(CheckpointRecord);
+  MPI_File_read_at_all(fh, offset, records.empty() ? NULL : &records[0],
+                       static_cast<int>(number), record_type, MPI_STATUS_IGNORE);
+}
+//----------------------------------------------------------------------
@@ -54,18 +54,24 @@ void
 Collision::Run(MDManager *mdm) {
   Parameter *param = mdm->GetParameter();
   const double *L = mdm->GetSystemSize();
-  double c1[D] = {L[X] * 0.25, L[Y] * 0.5, L[Z] * 0.5};
-  BallAdder ba1(c1, L[Y] * 0.25, 1.0, 0.374);
-  double c2[D] = {L[X] * 0.75, L[Y] * 0.5, L[Z] * 0.5};
-  BallAdder ba2(c2, L[Y] * 0.25, -1.0, 0.374);
-  mdm->ExecuteAll(&ba1);
-  mdm->ExecuteAll(&ba2);
-  mdm->SaveAsCdviewSequential();
+  if (!mdm->LoadInitialConfiguration(0.0)) {
+    double c1[D] = {L[X] * 0.25, L[Y] * 0.5, L[Z] * 0.5};
+    BallAdder ba1(c1, L[Y] * 0.25, 1.0, 0.374);
+    double c2[D] = {L[X] * 0.75, L[Y] * 0.5, L[Z] * 0.5};
+    BallAdder ba2(c2, L[Y] * 0.25, -1.0, 0.374);
+    mdm->ExecuteAll(&ba1);
+    mdm->ExecuteAll(&ba2);
+  }
+  // A restart goes on after the steps already taken
+  const int done = mdm->GetStepsInPhase();
+  if (done == 0) {
+    mdm->SaveAsCdviewSequential();
+  }
   const int OBSERVE_LOOP = param->GetIntegerDef("ObserveLoop", 100);
   const int TOTAL_LOOP = param->GetIntegerDef("TotalLoop", 1000);
   const bool save_cdview_file = param->GetBooleanDef("SaveCdviewFile", false);
   mdm->ShowSystemInformation();
-  for (int i = 0; i < TOTAL_LOOP; i++) {
+  for (int i = done; i < TOTAL_LOOP; i++) {
     mdm->Calculate();
     if (i % OBSERVE_LOOP == 0) {
       mout << mdm->GetSimulationTime();
@@ -1,6 +1,9 @@
 //----------------------------------------------------------------------
 // MPI Communication Class
 //----------------------------------------------------------------------
+#include <stdio.h>
+#include <limits.h>
+#include <algorithm>
 #include "communicator.h"
 //----------------------------------------------------------------------
 void
@@ -57,6 +60,21 @@ Communicator::FindMaxDouble(double value) {
   return max;
 }
 //----------------------------------------------------------------------
+int
+Communicator::FindMaxInteger(int value, MPI_Comm comm) {
+  int max = 0;
+  MPI_Allreduce(&value, &max, 1, MPI_INT, MPI_MAX, comm);
+  return max;
+}
+//----------------------------------------------------------------------
+int64_t
+Communicator::FindMinInteger64(int64_t value, MPI_Comm comm) {
+  long long v = value;
+  long long min = 0;
+  MPI_Allreduce(&v, &min, 1, MPI_LONG_LONG, MPI_MIN, comm);
+  return min;
+}
+//----------------------------------------------------------------------
 double
 Communicator::AllReduceDouble(double value) {
   double sum = 0;
@@ -70,8 +88,8 @@ Communicator::AllReduceDoubleBuffer(double *sendbuf, int size, double *recvbuf)
 }
 //----------------------------------------------------------------------
 void
-Communicator::AllGatherInteger(int *sendbuf, int number, int *recvbuf) {
-  MPI_Allgather(sendbuf, number, MPI_INT, recvbuf, number, MPI_INT, MPI_COMM_WORLD);
+Communicator::AllGatherInteger(int *sendbuf, int number, int *recvbuf, MPI_Comm comm) {
+  MPI_Allgather(sendbuf, number, MPI_INT, recvbuf, number, MPI_INT, comm);
 }
 //----------------------------------------------------------------------
 void
@@ -94,17 +112,49 @@ Communicator::AllGatherUCharVector(std::vector<unsigned char> &send_buffer, std:
 }
 //----------------------------------------------------------------------
 void
-Communicator::GatherIntegerVector(std::vector<int> &send_buffer, std::vector<int> &recv_buffer, int num_procs, int root) {
+Communicator::GatherIntegerVector(std::vector<int> &send_buffer, std::vector<int> &recv_buffer, int num_procs, int root, MPI_Comm comm) {
   const int sendcount = static_cast<int>(send_buffer.size());
   recv_buffer.clear();
   recv_buffer.resize(sendcount * num_procs);
-  MPI_Gather(&send_buffer[0], sendcount, MPI_INT, &recv_buffer[0], sendcount, MPI_INT, root, MPI_COMM_WORLD);
+  MPI_Gather(&send_buffer[0], sendcount, MPI_INT, &recv_buffer[0], sendcount, MPI_INT, root, comm);
+}
+//----------------------------------------------------------------------
+// Gather vectors whose lengths differ between processes
+//----------------------------------------------------------------------
+void
+Communicator::GatherIntegerVectorV(std::vector<int> &send_buffer, std::vector<int> &recv_buffer, int num_procs, int root, MPI_Comm comm) {
+  int sendcount = static_cast<int>(send_buffer.size());
+  std::vector<int> recvcounts(num_procs, 0);
+  std::vector<int> displs(num_procs, 0);
+  MPI_Gather(&sendcount, 1, MPI_INT, &recvcounts[0], 1, MPI_INT, root, comm);
+  int total = 0;
+  for (int i = 0; i < num_procs; i++) {
+    displs[i] = total;
+    total += recvcounts[i];
+  }
+  recv_buffer.resize(total);
+  MPI_Gatherv(send_buffer.data(), sendcount, MPI_INT, recv_buffer.data(), &recvcounts[0], &displs[0], MPI_INT, root, comm);
+}
+//----------------------------------------------------------------------
+void
+Communicator::AllGatherIntegerVectorV(std::vector<int> &send_buffer, std::vector<int> &recv_buffer, int num_procs, MPI_Comm comm) {
+  int sendcount = static_cast<int>(send_buffer.size());
+  std::vector<int> recvcounts(num_procs, 0);
+  std::vector<int> displs(num_procs, 0);
+  MPI_Allgather(&sendcount, 1, MPI_INT, &recvcounts[0], 1, MPI_INT, comm);
+  int total = 0;
+  for (int i = 0; i < num_procs; i++) {
+    displs[i] = total;
+    total += recvcounts[i];
+  }
+  recv_buffer.resize(total);
+  MPI_Allgatherv(send_buffer.data(), sendcount, MPI_INT, recv_buffer.data(), &recvcounts[0], &displs[0], MPI_INT, comm);
 }
 //----------------------------------------------------------------------
 void
-Communicator::GatherUCharVector(std::vector<unsigned char> &send_buffer, std::vector<unsigned char> &recv_buffer, int num_procs, int root) {
+Communicator::GatherUCharVector(std::vector<unsigned char> &send_buffer, std::vector<unsigned char> &recv_buffer, int num_procs, int root, MPI_Comm comm) {
   const int sendcount = static_cast<int>(send_buffer.size());
-  MPI_Gather(&send_buffer[0], sendcount, MPI_CHAR, &recv_buffer[0], sendcount, MPI_CHAR, root, MPI_COMM_WORLD);
+  MPI_Gather(&send_buffer[0], sendcount, MPI_CHAR, &recv_buffer[0], sendcount, MPI_CHAR, root, comm);
 }
 //----------------------------------------------------------------------
 double
@@ -117,3 +167,125 @@ Communicator::BroadcastInteger(int &value, int root) {
   MPI_Bcast(&value, 1, MPI_INT, root, MPI_COMM_WORLD);
 }
 //----------------------------------------------------------------------
+void
+Communicator::ISendBytes(void *buf, int size, int dest_rank, int tag, MPI_Request &req) {
+  MPI_Isend(buf, size, MPI_BYTE, dest_rank, tag, MPI_COMM_WORLD, &req);
+}
+//----------------------------------------------------------------------
+void
+Communicator::IRecvBytes(void *buf, int size, int src_rank, int tag, MPI_Request &req) {
+  MPI_Irecv(buf, size, MPI_BYTE, src_rank, tag, MPI_COMM_WORLD, &req);
+}
+//----------------------------------------------------------------------
+void
+Communicator::WaitAll(int number, MPI_Request *req) {
+  MPI_Waitall(number, req, MPI_STATUSES_IGNORE);
+}
+//----------------------------------------------------------------------
+int
+Communicator::GetTagUpperBound(void) {
+  int *value;
+  int flag;
+  MPI_Comm_get_attr(MPI_COMM_WORLD, MPI_TAG_UB, &value, &flag);
+  return flag ? *value : 32767;
+}
+//----------------------------------------------------------------------
+void
+Communicator::IAllReduceDoubleBuffer(double *sendbuf, int size, double *recvbuf, MPI_Request &req) {
+  MPI_Iallreduce(sendbuf, recvbuf, size, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD, &req);
+}
+//----------------------------------------------------------------------
+bool
+Communicator::Test(MPI_Request &req) {
+  int flag = 0;
+  MPI_Test(&req, &flag, MPI_STATUS_IGNORE);
+  return flag != 0;
+}
+//----------------------------------------------------------------------
+MPI_Datatype
+Communicator::CreateBlockType(size_t bytes) {
+  MPI_Datatype type;
+  MPI_Type_contiguous(static_cast<int>(bytes), MPI_BYTE, &type);
+  MPI_Type_commit(&type);
+  return type;
+}
+//----------------------------------------------------------------------
+// May be called from the snapshot thread, so mout is not used
+void
+Communicator::CheckElementNumber(int64_t number, const char *where) {
+  if (number <= INT_MAX) return;
+  fprintf(stderr, "Error: %s: %lld elements exceed the count of MPI\n", where,
+          static_cast<long long>(number));
+  MPI_Abort(MPI_COMM_WORLD, 1);
+}
+//----------------------------------------------------------------------
+MPI_Comm
+Communicator::DuplicateWorld(void) {
+  MPI_Comm comm;
+  MPI_Comm_dup(MPI_COMM_WORLD, &comm);
+  return comm;
+}
+//----------------------------------------------------------------------
+void
+Communicator::FreeComm(MPI_Comm &comm) {
+  MPI_Comm_free(&comm);
+}
+//----------------------------------------------------------------------
+// A probe on an otherwise unused communicator enters the MPI library,
+// which drives the progress of all outstanding requests.
+void
+Communicator::Progress(MPI_Comm comm) {
+  int flag = 0;
+  MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &flag, MPI_STATUS_IGNORE);
+}
+//----------------------------------------------------------------------
+bool
+Communicator::WriteOrderedBytes(const char *filename, std::vector<char> &buffer, MPI_Comm comm) {
+  MPI_File fh;
+  const bool opened = (MPI_File_open(comm, const_cast<char *>(filename), MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                                     MPI_INFO_NULL, &fh) == MPI_SUCCESS);
+  // All ranks give up if the open failed on any of them, so that none is
+  // left waiting in the collective writes
+  int ok = opened ? 1 : 0;
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_LAND, comm);
+  if (!ok) {
+    if (opened) MPI_File_close(&fh);
+    return false;
+  }
+  MPI_File_set_size(fh, 0);
+  long long size = buffer.size();
+  long long offset = 0;
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Exscan(&size, &offset, 1, MPI_LONG_LONG, MPI_SUM, comm);
+  // The receive buffer of MPI_Exscan is undefined on rank 0
+  if (rank == 0) offset = 0;
+  // Written in pieces whose byte counts fit in int, with the same number
+  // of collective calls on all ranks
+  const long long piece = 1LL << 30;
+  long long pieces = (size + piece - 1) / piece;
+  MPI_Allreduce(MPI_IN_PLACE, &pieces, 1, MPI_LONG_LONG, MPI_MAX, comm);
+  for (long long k = 0; k < pieces; k++) {
+    const long long start = std::min(k * piece, size);
+    const long long bytes = std::min(piece, size - start);
+    MPI_File_write_at_all(fh, offset + start, (bytes > 0) ? &buffer[start] : NULL,
+                          static_cast<int>(bytes), MPI_BYTE, MPI_STATUS_IGNORE);
+  }
+  MPI_File_close(&fh);
+  return true;
+}
+//----------------------------------------------------------------------
+void
+Communicator::ScanCounts(std::vector<int64_t> &count, std::vector<int64_t> &offset, std::vector<int64_t> &total, MPI_Comm comm) {
+  const int n = count.size();
+  std::vector<long long> c(count.begin(), count.end());
+  std::vector<long long> o(n, 0), t(n, 0);
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Exscan(&c[0], &o[0], n, MPI_LONG_LONG, MPI_SUM, comm);
+  if (rank == 0) std::fill(o.begin(), o.end(), 0);
+  MPI_Allreduce(&c[0], &t[0], n, MPI_LONG_LONG, MPI_SUM, comm);
+  offset.assign(o.begin(), o.end());
+  total.assign(t.begin(), t.end());
+}
+//----------------------------------------------------------------------
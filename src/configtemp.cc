@@ -9,39 +9,56 @@ Configtemp configtemp;
 void
 Configtemp::Run(MDManager *mdm) {
   Parameter *param = mdm->GetParameter();
-  ExactConfigurationMaker c(param, mdm->GetSystemSize());
-  //ConfigurationMaker c(param);
-  mdm->ExecuteAll(&c);
   const double v0 = param->GetDoubleDef("InitialVelocity", 1.0);
-  mdm->SetInitialVelocity(v0);
+  if (!mdm->LoadInitialConfiguration(v0)) {
+    ExactConfigurationMaker c(param, mdm->GetSystemSize());
+    //ConfigurationMaker c(param);
+    mdm->ExecuteAll(&c);
+    mdm->SetInitialVelocity(v0);
+  }
   const int T_LOOP = param->GetIntegerDef("ThermalizeLoop", 1000);
   const int LOOP = param->GetIntegerDef("TotalLoop", 1000);
   const int OBSERVE_LOOP = param->GetIntegerDef("ObserveLoop", 100);
-  mdm->SetControlTemperature(true);
-  mdm->ShowSystemInformation();
-  for (int i = 0; i < T_LOOP; i++) {
-    if (i % OBSERVE_LOOP == 0) {
-      mdm->MakePairList();
+  // Phase 0 thermalizes and phase 1 observes. A restart goes on after
+  // the steps already taken.
+  if (mdm->GetPhase() == 0) {
+    mdm->SetControlTemperature(true);
+    mdm->ShowSystemInformation();
+  }
+  const int first = (mdm->GetPhase() == 0) ? mdm->GetStepsInPhase() : T_LOOP;
+  for (int i = first; i < T_LOOP; i++) {
+    // The state at first was observed before the checkpoint
+    if (i % OBSERVE_LOOP == 0 && (i == 0 || i != first)) {
+      mdm->UpdateBorderParticles();
+      ThermoSnapshot ts = mdm->TakeThermoSnapshot();
       mout << mdm->GetSimulationTime();
-      mout << " " << mdm->Temperature();
-      mout << " " << mdm->ConfigurationTemperature();
-      mout << " " << mdm->Pressure();
-      mout << " " << mdm->TotalEnergy();
+      mout << " " << ts.Temperature();
+      mout << " " << ts.ConfigurationTemperature();
+      mout << " " << ts.Pressure();
+      mout << " " << ts.TotalEnergy();
       mout << " #Thermalize" << std::endl;
+      mout.Field("configuration_temperature", ts.ConfigurationTemperature());
+      mdm->RecordObservables("thermalize", ts);
     }
     mdm->Calculate();
   }
+  if (mdm->GetPhase() == 0) {
+    mdm->SetPhase(1);
+  }
   mdm->SetControlTemperature(false);
   mdm->ShowSystemInformation();
-  for (int i = 0; i < LOOP; i++) {
+  for (int i = mdm->GetStepsInPhase(); i < LOOP; i++) {
     mdm->Calculate();
     if (i % OBSERVE_LOOP == 0) {
+      ThermoSnapshot ts = mdm->TakeThermoSnapshot();
       mout << mdm->GetSimulationTime();
-      mout << " " << mdm->Temperature();
-      mout << " " << mdm->ConfigurationTemperature();
-      mout << " " << mdm->Pressure();
-      mout << " " << mdm->TotalEnergy();
+      mout << " " << ts.Temperature();
+      mout << " " << ts.ConfigurationTemperature();
+      mout << " " << ts.Pressure();
+      mout << " " << ts.TotalEnergy();
       mout << " " << std::endl;
+      mout.Field("configuration_temperature", ts.ConfigurationTemperature());
+      mdm->RecordObservables("observe", ts);
     }
   }
 
@@ -0,0 +1,482 @@
+//----------------------------------------------------------------------
+// Parallel Reader of External Configurations
+//----------------------------------------------------------------------
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <sstream>
+#include <omp.h>
+#include "communicator.h"
+#include "trajectoryfile.h"
+#include "trajectorycodec.h"
+#include "configurationreader.h"
+//----------------------------------------------------------------------
+namespace {
+//----------------------------------------------------------------------
+// Columns of a particle line, -1 if absent
+struct LineFormat {
+  int type;
+  int q[3];
+  int p[3];
+  // q = (x - shift) * scale
+  double shift[3];
+  double scale[3];
+};
+//----------------------------------------------------------------------
+// Start of the first line at or after pos, within [begin, end)
+int64_t
+LineStart(const char *data, int64_t begin, int64_t end, int64_t pos) {
+  if (pos <= begin) return begin;
+  while (pos < end && data[pos - 1] != '\n') pos++;
+  return std::min(pos, end);
+}
+//----------------------------------------------------------------------
+int64_t
+LineEnd(const char *data, int64_t end, int64_t pos) {
+  while (pos < end && data[pos] != '\n') pos++;
+  return pos;
+}
+//----------------------------------------------------------------------
+// Numeric fields of a line; a field which is not a number is NaN
+int
+SplitFields(const char *s, const char *e, double *fields, int max_fields) {
+  char buf[1024];
+  const int n = std::min(static_cast<int>(e - s), static_cast<int>(sizeof(buf)) - 1);
+  memcpy(buf, s, n);
+  buf[n] = 0;
+  int k = 0;
+  char *p = buf;
+  while (k < max_fields) {
+    while (*p == ' ' || *p == '\t' || *p == '\r') p++;
+    if (*p == 0) break;
+    char *q;
+    fields[k] = strtod(p, &q);
+    if (q == p) {
+      fields[k] = NAN;
+      while (*q != 0 && *q != ' ' && *q != '\t' && *q != '\r') q++;
+    }
+    p = q;
+    k++;
+  }
+  return k;
+}
+//----------------------------------------------------------------------
+// Lines starting in [start, stop), split among the threads at line
+// starts. Empty and '#' lines are skipped.
+//----------------------------------------------------------------------
+void
+ParseLines(const char *data, int64_t begin, int64_t end, int64_t start, int64_t stop, int num_threads,
+           const LineFormat &fmt, std::vector<CheckpointRecord> &records, int64_t &bad, bool &velocity) {
+  const int MAX_FIELDS = 64;
+  int min_fields = fmt.type + 1;
+  int velocity_fields = 0;
+  for (int d = 0; d < 3; d++) {
+    min_fields = std::max(min_fields, fmt.q[d] + 1);
+    velocity_fields = std::max(velocity_fields, fmt.p[d] + 1);
+  }
+  std::vector<int64_t> split(num_threads + 1);
+  for (int t = 0; t <= num_threads; t++) {
+    split[t] = LineStart(data, begin, end, start + (stop - start) * t / num_threads);
+  }
+  std::vector<std::vector<CheckpointRecord> > part(num_threads);
+  std::vector<int64_t> part_bad(num_threads, 0);
+  std::vector<int> part_velocity(num_threads, 1);
+  #pragma omp parallel for schedule(static) num_threads(num_threads)
+  for (int t = 0; t < num_threads; t++) {
+    double f[MAX_FIELDS];
+    int64_t pos = split[t];
+    while (pos < split[t + 1]) {
+      const int64_t e = LineEnd(data, end, pos);
+      const char *s = data + pos;
+      while (s < data + e && (*s == ' ' || *s == '\t' || *s == '\r')) s++;
+      if (s < data + e && *s != '#') {
+        const int n = SplitFields(s, data + e, f, MAX_FIELDS);
+        if (n < min_fields) {
+          part_bad[t]++;
+        } else {
+          CheckpointRecord r;
+          r.type = static_cast<int32_t>(f[fmt.type]);
+          r.reserved = 0;
+          const bool v = (velocity_fields > 0 && n >= velocity_fields);
+          for (int d = 0; d < 3; d++) {
+            r.q[d] = (f[fmt.q[d]] - fmt.shift[d]) * fmt.scale[d];
+            r.p[d] = v ? f[fmt.p[d]] : 0.0;
+          }
+          if (!v) part_velocity[t] = 0;
+          part[t].push_back(r);
+        }
+      }
+      pos = e + 1;
+    }
+  }
+  for (int t = 0; t < num_threads; t++) {
+    records.insert(records.end(), part[t].begin(), part[t].end());
+    bad += part_bad[t];
+    velocity = velocity && part_velocity[t];
+  }
+}
+//----------------------------------------------------------------------
+bool
+EndsWith(const std::string &s, const char *suffix) {
+  const size_t n = strlen(suffix);
+  return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+//----------------------------------------------------------------------
+}
+//----------------------------------------------------------------------
+int
+ConfigurationReader::GetFormat(const std::string &filename, const std::string &name) {
+  for (int format = CDVIEW; format <= CHECKPOINT; format++) {
+    if (name == GetName(format)) return format;
+  }
+  if (name != "auto") return UNKNOWN;
+  if (EndsWith(filename, ".cd") || EndsWith(filename, ".cdv")) return CDVIEW;
+  if (EndsWith(filename, ".mdt")) return TRAJECTORY;
+  if (EndsWith(filename, ".chk")) return CHECKPOINT;
+  if (EndsWith(filename, ".lammpstrj") || EndsWith(filename, ".dump")) return LAMMPS;
+  return UNKNOWN;
+}
+//----------------------------------------------------------------------
+const char *
+ConfigurationReader::GetName(int format) {
+  switch (format) {
+  case CDVIEW:
+    return "cdview";
+  case LAMMPS:
+    return "lammps";
+  case TRAJECTORY:
+    return "trajectory";
+  case CHECKPOINT:
+    return "checkpoint";
+  }
+  return "unknown";
+}
+//----------------------------------------------------------------------
+ConfigurationReader::ConfigurationReader(const char *filename, int format_, int frame_, int num_threads_) {
+  fd = -1;
+  data = NULL;
+  size = 0;
+  format = format_;
+  frame = frame_;
+  num_threads = std::max(num_threads_, 1);
+  has_velocity = false;
+  has_box = false;
+  expected = -1;
+  L[0] = L[1] = L[2] = 0.0;
+  fd = open(filename, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+    error = "cannot open the file";
+    return;
+  }
+  size = st.st_size;
+  void *p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    error = "cannot map the file";
+    return;
+  }
+  data = static_cast<const char *>(p);
+  madvise(p, size, MADV_SEQUENTIAL);
+}
+//----------------------------------------------------------------------
+ConfigurationReader::~ConfigurationReader(void) {
+  if (data != NULL) munmap(const_cast<char *>(data), size);
+  if (fd >= 0) close(fd);
+}
+//----------------------------------------------------------------------
+bool
+ConfigurationReader::Read(int rank, int num_procs, std::vector<CheckpointRecord> &records) {
+  records.clear();
+  if (data == NULL) return false;
+  switch (format) {
+  case CDVIEW:
+    return ReadCdview(rank, num_procs, records);
+  case LAMMPS:
+    return ReadLammps(rank, num_procs, records);
+  case TRAJECTORY:
+    return ReadTrajectory(rank, num_procs, records);
+  }
+  error = "unsupported format";
+  return false;
+}
+//----------------------------------------------------------------------
+bool
+ConfigurationReader::ReadCdview(int rank, int num_procs, std::vector<CheckpointRecord> &records) {
+  LineFormat fmt;
+  fmt.type = 1;
+  for (int d = 0; d < 3; d++) {
+    fmt.q[d] = 2 + d;
+    fmt.p[d] = 5 + d;
+    fmt.shift[d] = 0.0;
+    fmt.scale[d] = 1.0;
+  }
+  const int64_t start = size * rank / num_procs;
+  const int64_t stop = size * (rank + 1) / num_procs;
+  int64_t bad = 0;
+  has_velocity = true;
+  ParseLines(data, 0, size, start, stop, num_threads, fmt, records, bad, has_velocity);
+  if (bad > 0) {
+    std::ostringstream oss;
+    oss << bad << " malformed line(s)";
+    error = oss.str();
+    return false;
+  }
+  return true;
+}
+//----------------------------------------------------------------------
+// Every rank reads the header. The first frame ends at the first line
+// starting with "ITEM:" after the atoms, which the ranks look for in
+// their own ranges and agree on with one reduction.
+//----------------------------------------------------------------------
+bool
+ConfigurationReader::ReadLammps(int rank, int num_procs, std::vector<CheckpointRecord> &records) {
+  LineFormat fmt;
+  fmt.type = -1;
+  for (int d = 0; d < 3; d++) {
+    fmt.q[d] = fmt.p[d] = -1;
+    fmt.shift[d] = 0.0;
+    fmt.scale[d] = 1.0;
+  }
+  double lo[3] = {0.0, 0.0, 0.0};
+  double hi[3] = {0.0, 0.0, 0.0};
+  bool scaled = false;
+  int64_t pos = 0;
+  int64_t body = -1;
+  while (pos < size && body < 0) {
+    const int64_t e = LineEnd(data, size, pos);
+    const std::string line(data + pos, e - pos);
+    pos = e + 1;
+    if (line.compare(0, 21, "ITEM: NUMBER OF ATOMS") == 0) {
+      const int64_t e2 = LineEnd(data, size, pos);
+      expected = atoll(std::string(data + pos, e2 - pos).c_str());
+      pos = e2 + 1;
+    } else if (line.compare(0, 16, "ITEM: BOX BOUNDS") == 0) {
+      if (line.find("xy") != std::string::npos) {
+        error = "triclinic boxes are not supported";
+        return false;
+      }
+      for (int d = 0; d < 3; d++) {
+        const int64_t e2 = LineEnd(data, size, pos);
+        double f[2];
+        if (SplitFields(data + pos, data + e2, f, 2) < 2) {
+          error = "malformed BOX BOUNDS";
+          return false;
+        }
+        lo[d] = f[0];
+        hi[d] = f[1];
+        pos = e2 + 1;
+      }
+      has_box = true;
+    } else if (line.compare(0, 11, "ITEM: ATOMS") == 0) {
+      std::istringstream iss(line.substr(11));
+      std::string column;
+      const char *names[3][4] = {{"x", "xu", "xs", "xsu"}, {"y", "yu", "ys", "ysu"}, {"z", "zu", "zs", "zsu"}};
+      const char *vnames[3] = {"vx", "vy", "vz"};
+      for (int k = 0; iss >> column; k++) {
+        if (column == "type") fmt.type = k;
+        for (int d = 0; d < 3; d++) {
+          for (int j = 0; j < 4; j++) {
+            if (column == names[d][j]) {
+              fmt.q[d] = k;
+              scaled = (j >= 2);
+            }
+          }
+          if (column == vnames[d]) fmt.p[d] = k;
+        }
+      }
+      body = pos;
+    }
+  }
+  if (body < 0 || !has_box || fmt.type < 0 || fmt.q[0] < 0 || fmt.q[1] < 0 || fmt.q[2] < 0) {
+    error = "missing ITEM: BOX BOUNDS, ITEM: ATOMS, or the type and position columns";
+    return false;
+  }
+  has_velocity = (fmt.p[0] >= 0 && fmt.p[1] >= 0 && fmt.p[2] >= 0);
+  if (!has_velocity) {
+    fmt.p[0] = fmt.p[1] = fmt.p[2] = -1;
+  }
+  for (int d = 0; d < 3; d++) {
+    L[d] = hi[d] - lo[d];
+    fmt.shift[d] = scaled ? 0.0 : lo[d];
+    fmt.scale[d] = scaled ? L[d] : 1.0;
+  }
+  body = std::min(body, size);
+  const int64_t start = body + (size - body) * rank / num_procs;
+  const int64_t stop = body + (size - body) * (rank + 1) / num_procs;
+  int64_t next = size;
+  for (int64_t i = std::max(start, body + 1) - 1; i < stop - 1; i++) {
+    if (data[i] == '\n' && i + 6 <= size && memcmp(data + i + 1, "ITEM:", 5) == 0) {
+      next = i + 1;
+      break;
+    }
+  }
+  const int64_t end = Communicator::FindMinInteger64(next);
+  int64_t bad = 0;
+  bool velocity = true;
+  ParseLines(data, body, end, std::min(start, end), std::min(stop, end), num_threads, fmt, records, bad, velocity);
+  if (bad > 0) {
+    std::ostringstream oss;
+    oss << bad << " malformed line(s)";
+    error = oss.str();
+    return false;
+  }
+  return true;
+}
+//----------------------------------------------------------------------
+// The particles of the frame are divided among the ranks in file order.
+// A compressed chunk goes to the rank of its first particle.
+//----------------------------------------------------------------------
+bool
+ConfigurationReader::ReadTrajectory(int rank, int num_procs, std::vector<CheckpointRecord> &records) {
+  TrajectoryHeader header;
+  if (size < static_cast<int64_t>(sizeof(header))) {
+    error = "not a trajectory file";
+    return false;
+  }
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, TrajectoryFile::MAGIC, sizeof(header.magic)) != 0
+      || header.version != TrajectoryFile::VERSION
+      || header.record_size != static_cast<int>(sizeof(TrajectoryRecord))) {
+    error = "not a trajectory file of this version";
+    return false;
+  }
+  if (header.num_frames <= 0 || header.index_offset < static_cast<int64_t>(sizeof(header))
+      || header.index_offset > size
+      || header.num_frames > (size - header.index_offset) / static_cast<int64_t>(sizeof(TrajectoryIndexEntry))) {
+    error = "no valid frame index";
+    return false;
+  }
+  const int f = (frame < 0) ? header.num_frames + frame : frame;
+  if (f < 0 || f >= header.num_frames) {
+    error = "no such frame";
+    return false;
+  }
+  TrajectoryIndexEntry e;
+  memcpy(&e, data + header.index_offset + f * sizeof(TrajectoryIndexEntry), sizeof(e));
+  if (e.offset < static_cast<int64_t>(sizeof(header)) || e.bytes < 0 || e.offset > size - e.bytes
+      || e.num_types < 0 || e.num_types > TrajectoryFile::MAX_TYPES
+      || e.bytes < TrajectoryFile::FrameSize(e.num_types, 0)) {
+    error = "invalid frame";
+    return false;
+  }
+  // The frame header must agree with the validated index entry, and the
+  // type sizes must fill the frame, before any of them is used
+  TrajectoryFrameHeader fr;
+  memcpy(&fr, data + e.offset, sizeof(fr));
+  if (memcmp(fr.magic, TrajectoryFile::FRAME_MAGIC, sizeof(fr.magic)) != 0
+      || fr.num_types != e.num_types || fr.codec != e.codec || fr.num_particles < 0
+      || fr.codec < TrajectoryCodec::RAW || fr.codec > TrajectoryCodec::LOSSLESS) {
+    error = "invalid frame";
+    return false;
+  }
+  const int nt = fr.num_types;
+  std::vector<int64_t> sizes(2 * nt);
+  if (nt > 0) {
+    memcpy(&sizes[0], data + e.offset + sizeof(fr), sizeof(int64_t) * 2 * nt);
+  }
+  int64_t count_sum = 0;
+  int64_t byte_sum = 0;
+  for (int t = 0; t < nt; t++) {
+    if (sizes[t] < 0 || sizes[nt + t] < 0 || sizes[t] > fr.num_particles - count_sum
+        || sizes[nt + t] > e.bytes - byte_sum) {
+      error = "invalid frame";
+      return false;
+    }
+    if (fr.codec == TrajectoryCodec::RAW
+        && sizes[nt + t] != sizes[t] * static_cast<int64_t>(sizeof(TrajectoryRecord))) {
+      error = "invalid frame";
+      return false;
+    }
+    count_sum += sizes[t];
+    byte_sum += sizes[nt + t];
+  }
+  if (count_sum != fr.num_particles || TrajectoryFile::FrameSize(nt, byte_sum) != e.bytes) {
+    error = "invalid frame";
+    return false;
+  }
+  for (int d = 0; d < 3; d++) {
+    L[d] = fr.L[d];
+  }
+  has_box = true;
+  has_velocity = true;
+  expected = fr.num_particles;
+  const int64_t start = fr.num_particles * rank / num_procs;
+  const int64_t stop = fr.num_particles * (rank + 1) / num_procs;
+  const char *block = data + e.offset + sizeof(fr) + sizeof(int64_t) * 2 * nt;
+  int64_t first = 0;
+  std::vector<const char *> chunks;
+  std::vector<int> chunk_type;
+  for (int t = 0; t < nt; t++) {
+    const int64_t count = sizes[t];
+    const char *type_end = block + sizes[nt + t];
+    if (fr.codec == TrajectoryCodec::RAW) {
+      const TrajectoryRecord *r = reinterpret_cast<const TrajectoryRecord *>(block);
+      for (int64_t i = std::max(start - first, static_cast<int64_t>(0)); i < std::min(stop - first, count); i++) {
+        CheckpointRecord c;
+        for (int d = 0; d < 3; d++) {
+          c.q[d] = r[i].q[d];
+          c.p[d] = r[i].p[d];
+        }
+        c.type = t;
+        c.reserved = 0;
+        records.push_back(c);
+      }
+    } else {
+      // Every chunk must lie within its type, and the chunks must hold
+      // exactly the particles of the type
+      const char *c = block;
+      int64_t index = first;
+      while (c < type_end) {
+        TrajectoryChunk chunk;
+        if (type_end - c < static_cast<int64_t>(sizeof(chunk))) break;
+        memcpy(&chunk, c, sizeof(chunk));
+        if (chunk.bytes < static_cast<int64_t>(sizeof(chunk)) || chunk.bytes > type_end - c
+            || chunk.num_particles < 0 || chunk.num_particles > first + count - index) break;
+        if (index >= start && index < stop) {
+          chunks.push_back(c);
+          chunk_type.push_back(t);
+        }
+        index += chunk.num_particles;
+        c += chunk.bytes;
+      }
+      if (c != type_end || index != first + count) {
+        error = "invalid frame";
+        return false;
+      }
+    }
+    first += count;
+    block += sizes[nt + t];
+  }
+  const int num_chunks = chunks.size();
+  std::vector<std::vector<TrajectoryParticle> > particles(num_chunks);
+  int bad = 0;
+  #pragma omp parallel for schedule(dynamic) num_threads(num_threads) reduction(+:bad)
+  for (int k = 0; k < num_chunks; k++) {
+    if (TrajectoryCodec::Decode(fr.codec, chunks[k], particles[k]) < 0) bad++;
+  }
+  if (bad > 0) {
+    std::ostringstream oss;
+    oss << bad << " malformed chunk(s)";
+    error = oss.str();
+    return false;
+  }
+  for (int k = 0; k < num_chunks; k++) {
+    for (unsigned int i = 0; i < particles[k].size(); i++) {
+      CheckpointRecord c;
+      for (int d = 0; d < 3; d++) {
+        c.q[d] = particles[k][i].q[d];
+        c.p[d] = particles[k][i].p[d];
+      }
+      c.type = chunk_type[k];
+      c.reserved = 0;
+      records.push_back(c);
+    }
+  }
+  return true;
+}
+//----------------------------------------------------------------------
@@ -9,23 +9,28 @@ Langevin langevin;
 void
 Langevin::Run(MDManager *mdm) {
   Parameter *param = mdm->GetParameter();
-  ConfigurationMaker c(param);
-  mdm->ExecuteAll(&c);
   const double v0 = param->GetDoubleDef("InitialVelocity", 1.0);
-  mdm->SetInitialVelocity(v0);
+  if (!mdm->LoadInitialConfiguration(v0)) {
+    ConfigurationMaker c(param);
+    mdm->ExecuteAll(&c);
+    mdm->SetInitialVelocity(v0);
+  }
   const int LOOP = param->GetIntegerDef("TotalLoop", 1000);
   const int OBSERVE_LOOP = param->GetIntegerDef("ObserveLoop", 100);
   mdm->SetControlTemperature(true);
   mdm->ShowSystemInformation();
   mdm->MakePairList();
-  for (int i = 0; i < LOOP; i++) {
+  // A restart goes on after the steps already taken
+  for (int i = mdm->GetStepsInPhase(); i < LOOP; i++) {
     mdm->Calculate();
     if (i % OBSERVE_LOOP == 0) {
+      ThermoSnapshot ts = mdm->TakeThermoSnapshot();
       mout << mdm->GetSimulationTime();
-      mout << " " << mdm->Temperature();
-      mout << " " << mdm->Pressure();
-      mout << " " << mdm->TotalEnergy();
+      mout << " " << ts.Temperature();
+      mout << " " << ts.Pressure();
+      mout << " " << ts.TotalEnergy();
       mout << "# observe" << std::endl;
+      mdm->RecordObservables("observe", ts);
     }
   }
 }
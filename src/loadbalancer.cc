@@ -0,0 +1,101 @@
+//----------------------------------------------------------------------
+#include <algorithm>
+#include "loadbalancer.h"
+//----------------------------------------------------------------------
+LoadBalancer::LoadBalancer(ParaInfo *pinfo, Parameter &param) {
+  pinfo->GetGridSize(grid_size);
+  for (int d = 0; d < 3; d++) {
+    planes[d].resize(grid_size[d] + 1);
+    for (int k = 0; k <= grid_size[d]; k++) {
+      planes[d][k] = static_cast<double>(k) / static_cast<double>(grid_size[d]);
+    }
+  }
+  damping = param.GetDoubleDef("LoadBalanceDamping", 0.5);
+  imbalance = 1.0;
+}
+//----------------------------------------------------------------------
+// work: measured work of all units indexed by unit id
+//----------------------------------------------------------------------
+bool
+LoadBalancer::Balance(const std::vector<double> &work, ParaInfo *pinfo, SimulationInfo *sinfo) {
+  double sum = 0.0;
+  double max = 0.0;
+  for (unsigned int i = 0; i < work.size(); i++) {
+    sum += work[i];
+    max = std::max(max, work[i]);
+  }
+  if (sum <= 0.0) return false;
+  imbalance = max * static_cast<double>(work.size()) / sum;
+
+  bool changed = false;
+  for (int d = 0; d < 3; d++) {
+    std::vector<double> slab_work(grid_size[d], 0.0);
+    for (unsigned int id = 0; id < work.size(); id++) {
+      int pos[D];
+      pinfo->GetGridPosition(id, pos);
+      slab_work[pos[d]] += work[id];
+    }
+    changed |= BalanceAxis(d, slab_work, sinfo);
+  }
+  return changed;
+}
+//----------------------------------------------------------------------
+// Move the planes toward equal cumulative work, assuming the work is
+// uniform inside each slab. A plane moves at most half of the width of
+// the adjacent slabs, so that no particle crosses more than one plane
+// per axis, and no slab gets narrower than SearchLength.
+//----------------------------------------------------------------------
+bool
+LoadBalancer::BalanceAxis(const int d, const std::vector<double> &slab_work, SimulationInfo *sinfo) {
+  const int g = grid_size[d];
+  if (g < 2) return false;
+  std::vector<double> &b = planes[d];
+  double total = 0.0;
+  for (int k = 0; k < g; k++) {
+    total += slab_work[k];
+  }
+  if (total <= 0.0) return false;
+
+  std::vector<double> nb(b);
+  int k = 0;
+  double cumulative = 0.0;
+  for (int j = 1; j < g; j++) {
+    const double target = total * static_cast<double>(j) / static_cast<double>(g);
+    while (k < g - 1 && cumulative + slab_work[k] < target) {
+      cumulative += slab_work[k];
+      k++;
+    }
+    double x = b[k + 1];
+    if (slab_work[k] > 0.0) {
+      x = b[k] + (b[k + 1] - b[k]) * (target - cumulative) / slab_work[k];
+    }
+    x = b[j] + damping * (x - b[j]);
+    const double lower = b[j] - 0.5 * (b[j] - b[j - 1]);
+    const double upper = b[j] + 0.5 * (b[j + 1] - b[j]);
+    nb[j] = std::min(std::max(x, lower), upper);
+  }
+
+  const double min_width = sinfo->SearchLength / sinfo->L[d];
+  for (int j = 0; j < g; j++) {
+    if (nb[j + 1] - nb[j] < min_width) return false;
+  }
+  b = nb;
+  return true;
+}
+//----------------------------------------------------------------------
+MDRect
+LoadBalancer::GetRect(int id, ParaInfo *pinfo, SimulationInfo *sinfo) {
+  int pos[D];
+  pinfo->GetGridPosition(id, pos);
+  double s[D], e[D];
+  for (int d = 0; d < D; d++) {
+    s[d] = 0.0;
+    e[d] = 0.0;
+  }
+  for (int d = 0; d < 3; d++) {
+    s[d] = planes[d][pos[d]] * sinfo->L[d];
+    e[d] = planes[d][pos[d] + 1] * sinfo->L[d];
+  }
+  return MDRect(s, e);
+}
+//----------------------------------------------------------------------
@@ -2,6 +2,9 @@
 #include <omp.h>
 #include <mpi.h>
 #include <stdlib.h>
+#include <signal.h>
+#include <limits.h>
+#include <algorithm>
 #ifdef USE_GPU
 #include <cuda_runtime.h>
 #include <helper_cuda.h>
@@ -10,23 +13,44 @@
 #include "communicator.h"
 #include "mpistream.h"
 #include "mdmanager.h"
+#include "configurationreader.h"
 #include "observer.h"
 #include "stopwatch.h"
 #include "cmdline.h"
 #include "helper_macros.h"
 //----------------------------------------------------------------------
+static volatile sig_atomic_t stop_signal = 0;
+//----------------------------------------------------------------------
+// A second signal takes the default action, for a job which does not
+// reach the next check
+static void
+StopHandler(int sig) {
+  if (stop_signal != 0) {
+    signal(sig, SIG_DFL);
+    raise(sig);
+  }
+  stop_signal = sig;
+}
+//----------------------------------------------------------------------
+// WallTime is given in seconds or as [[hh:]mm:]ss like the job scripts
+static double
+ParseWallTime(const std::string &str) {
+  double t = 0.0;
+  size_t start = 0;
+  while (true) {
+    const size_t end = str.find(':', start);
+    t = t * 60.0 + atof(str.substr(start, end - start).c_str());
+    if (end == std::string::npos) return t;
+    start = end + 1;
+  }
+}
+//----------------------------------------------------------------------
 MDManager::MDManager(int &argc, char ** &argv) {
-  MPI_Init(&argc, &argv);
-  MPI_Comm_size(MPI_COMM_WORLD, &num_procs);
-  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-  mout.SetRank(rank);
-  mout << "# " << MDACP_VERSION << std::endl;
-
+  // The input is read first since it decides the MPI thread level
   cmdline::parser arg_parser;
   arg_parser.add<std::string>("in", 'i', "input file name", false, "input.cfg");
 #ifdef USE_GPU
   const auto num_gpus_avail = get_number_of_devices();
-  mout << "# " << num_gpus_avail << "GPUs are found." << std::endl;
   arg_parser.add<int>("num_gpus_per_node", 'g', "number of gpus per one node",
                       false, num_gpus_avail, cmdline::range(1, num_gpus_avail));
   arg_parser.add<int>("num_procs_per_gpu", 'p', "number of processes per one gpu",
@@ -35,10 +59,51 @@ MDManager::MDManager(int &argc, char ** &argv) {
   arg_parser.parse_check(argc, argv);
   const std::string inputfile = arg_parser.get<std::string>("in");
   param.LoadFromFile(inputfile.c_str());
+  thread_multiple = param.GetBooleanDef("ThreadMultiple", false);
+  bool progress_thread = param.GetBooleanDef("ProgressThread", false);
+  bool async_snapshot = param.GetBooleanDef("AsyncSnapshot", false);
+
+  const bool multiple = thread_multiple || progress_thread || async_snapshot;
+  const int required = multiple ? MPI_THREAD_MULTIPLE : MPI_THREAD_SERIALIZED;
+  int provided;
+  MPI_Init_thread(&argc, &argv, required, &provided);
+  MPI_Comm_size(MPI_COMM_WORLD, &num_procs);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  start_wall_time = Communicator::GetTime();
+  mout.SetRank(rank);
+  mout.SetFlushInterval(param.GetDoubleDef("OutputFlushInterval", 1.0));
+  const std::string outputfile = param.GetStringDef("OutputFile", "");
+  if (outputfile != "" && !mout.OpenLog(outputfile, param.GetBooleanDef("OutputAppend", false))) {
+    show_warning("Cannot open " + outputfile);
+  }
+  const std::string recordfile = param.GetStringDef("RecordFile", "");
+  if (recordfile != "") {
+    const std::string format = param.GetStringDef("RecordFormat", "csv");
+    if (format != "csv" && format != "json") {
+      show_warning("RecordFormat must be csv or json; csv is used");
+    }
+    if (!mout.OpenRecords(recordfile, (format == "json") ? MPIStream::JSON : MPIStream::CSV)) {
+      show_warning("Cannot open " + recordfile);
+    }
+  }
+  mout << "# " << MDACP_VERSION << std::endl;
+#ifdef USE_GPU
+  mout << "# " << num_gpus_avail << "GPUs are found." << std::endl;
+#endif
 
   num_threads = omp_get_max_threads();
+  const int units_per_thread = param.GetIntegerDef("UnitsPerThread", 1);
+  num_units = num_threads * units_per_thread;
   mout << "# " << num_procs << " MPI Process(es), " << num_threads
-       << " OpenMP Thread(s), Total " << num_procs * num_threads << " Unit(s)" << std::endl;
+       << " OpenMP Thread(s), " << units_per_thread << " Unit(s)/Thread, Total "
+       << num_procs * num_units << " Unit(s)" << std::endl;
+  work_stealing = param.GetBooleanDef("WorkStealing", false);
+  if (work_stealing) {
+    omp_set_schedule(omp_sched_dynamic, 1);
+    mout << "# WorkStealing = yes" << std::endl;
+  } else {
+    omp_set_schedule(omp_sched_static, 0);
+  }
 
 #ifdef USE_GPU
   const auto ngpus_per_node  = arg_parser.get<int>("num_gpus_per_node");
@@ -55,28 +120,176 @@ MDManager::MDManager(int &argc, char ** &argv) {
   checkCudaErrors(cudaSetDevice(gpu_id_local));
 #endif
 
-  pinfo = new ParaInfo(num_procs, num_threads, param);
+  pinfo = new ParaInfo(num_procs, num_units, param);
   int grid_size[D];
   pinfo->GetGridSize(grid_size);
   sinfo = new SimulationInfo(param, grid_size);
+  balancer = new LoadBalancer(pinfo, param);
+  load_balance_interval = param.GetIntegerDef("LoadBalanceInterval", 0);
+  step = 0;
+  checked_step = 0;
+  phase = 0;
+  phase_step = 0;
+  cdview_frame = 0;
+  pairlist_made = false;
+  expiry_ready = false;
+  expiry_global = false;
+  persistent_region = param.GetBooleanDef("PersistentRegion", false);
+#ifdef USE_GPU
+  if (persistent_region) {
+    show_warning("PersistentRegion is not supported with GPU. Disabled.");
+    persistent_region = false;
+  }
+#endif
+  if (persistent_region) {
+    mout << "# PersistentRegion = yes" << std::endl;
+  }
+  if (thread_multiple && provided < MPI_THREAD_MULTIPLE) {
+    show_warning("MPI_THREAD_MULTIPLE is not provided. ThreadMultiple is disabled.");
+    thread_multiple = false;
+  }
+  if (thread_multiple && GetUnitTag(num_units, 0, 0) > Communicator::GetTagUpperBound()) {
+    show_warning("Too many units for MPI tags. ThreadMultiple is disabled.");
+    thread_multiple = false;
+  }
+  if (thread_multiple) {
+    mout << "# ThreadMultiple = yes" << std::endl;
+  }
+  overlap_interior_pairs = param.GetBooleanDef("OverlapInteriorPairs", false);
+#ifdef USE_GPU
+  if (overlap_interior_pairs) {
+    show_warning("OverlapInteriorPairs is not supported with GPU. Disabled.");
+    overlap_interior_pairs = false;
+  }
+#endif
+  if (overlap_interior_pairs) {
+    mout << "# OverlapInteriorPairs = yes" << std::endl;
+  }
+  overlap_reduction = param.GetBooleanDef("NonblockingReduction", false);
+  if (overlap_reduction && persistent_region) {
+    show_warning("NonblockingReduction is not used with PersistentRegion.");
+    overlap_reduction = false;
+  }
+  if (overlap_reduction) {
+    mout << "# NonblockingReduction = yes" << std::endl;
+  }
+  reduction_pending = false;
+  reduction_ready = false;
+  reduction_steps = 0;
+  reduction_completed = 0;
+  reduction_window = 0.0;
+  reduction_wait = 0.0;
+  progress = NULL;
+  if (progress_thread && provided < MPI_THREAD_MULTIPLE) {
+    show_warning("MPI_THREAD_MULTIPLE is not provided. ProgressThread is disabled.");
+    progress_thread = false;
+  }
+  if (progress_thread) {
+    progress = new ProgressThread(param.GetIntegerDef("ProgressInterval", 10));
+    mout << "# ProgressThread = yes" << std::endl;
+  }
+  snapshot_writer = NULL;
+  if (async_snapshot && provided < MPI_THREAD_MULTIPLE) {
+    show_warning("MPI_THREAD_MULTIPLE is not provided. AsyncSnapshot is disabled.");
+    async_snapshot = false;
+  }
+  if (async_snapshot) {
+    snapshot_writer = new SnapshotWriter(param.GetIntegerDef("SnapshotBuffers", 2));
+    mout << "# AsyncSnapshot = yes" << std::endl;
+  }
+  trajectory = NULL;
+  if (param.GetBooleanDef("Trajectory", false)) {
+    const std::string filename = param.GetStringDef("TrajectoryFile", "traj.mdt");
+    const std::string codec_name = param.GetStringDef("TrajectoryCodec", "raw");
+    int codec = TrajectoryCodec::GetCodec(codec_name.c_str());
+    if (codec < 0) {
+      show_warning("Unknown TrajectoryCodec " << codec_name << ". raw is used.");
+      codec = TrajectoryCodec::RAW;
+    }
+    const double precision = param.GetDoubleDef("TrajectoryPrecision", 1e-3);
+    const double momentum_precision = param.GetDoubleDef("TrajectoryMomentumPrecision", precision);
+    if (codec == TrajectoryCodec::QUANTIZED && (precision <= 0.0 || momentum_precision <= 0.0)) {
+      show_warning("TrajectoryPrecision must be positive. lossless is used.");
+      codec = TrajectoryCodec::LOSSLESS;
+    }
+    // The snapshot thread should not take the cores of the integrator
+    const int encode_threads = param.GetIntegerDef("TrajectoryEncodeThreads",
+                               (NULL != snapshot_writer) ? 1 : num_threads);
+    const bool append = param.GetBooleanDef("TrajectoryAppend", false);
+    trajectory = new TrajectoryWriter(filename.c_str(), append, codec, precision,
+                                      momentum_precision, encode_threads);
+    if (trajectory->Open(MPI_COMM_WORLD)) {
+      mout << "# Trajectory = " << filename << " (" << TrajectoryCodec::GetName(codec) << ")" << std::endl;
+    } else {
+      if (append) {
+        show_warning("Cannot append to " << filename << ", which is not a valid trajectory. Trajectory is disabled.");
+      } else {
+        show_warning("Cannot open " << filename << ". Trajectory is disabled.");
+      }
+      delete trajectory;
+      trajectory = NULL;
+    }
+  }
+  checkpoint_file = param.GetStringDef("CheckpointFile", "checkpoint.dat");
+  checkpoint_keep = std::max(1, param.GetIntegerDef("CheckpointKeep", 1));
+  checkpoint_interval = std::max(0, param.GetIntegerDef("CheckpointInterval", 0));
+  wall_time = ParseWallTime(param.GetStringDef("WallTime", "0"));
+  wall_time_margin = param.GetDoubleDef("WallTimeMargin", 60.0);
+  const bool stop_signals = param.GetBooleanDef("StopSignals", false);
+  if (stop_signals) {
+    struct sigaction sa;
+    sa.sa_handler = StopHandler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+  }
+  stop_check_interval = 0;
+  if (stop_signals || wall_time > 0.0) {
+    stop_check_interval = std::max(1, param.GetIntegerDef("StopCheckInterval", 100));
+    mout << "# Stop on " << (stop_signals ? "SIGUSR1/SIGTERM" : "")
+         << ((stop_signals && wall_time > 0.0) ? " or " : "");
+    if (wall_time > 0.0) {
+      mout << "WallTime = " << wall_time << " s (margin " << wall_time_margin << " s)";
+    }
+    mout << ", checked every " << stop_check_interval << " step(s)" << std::endl;
+  }
+  if (checkpoint_interval > 0) {
+    mout << "# Checkpoint to " << checkpoint_file << " every " << checkpoint_interval
+         << " step(s), " << checkpoint_keep << " kept" << std::endl;
+  }
+  check_wall_time = Communicator::GetTime();
   int tid;
   MDUnit *mdp;
   std::vector <MDUnit *> v;
+  // Each thread creates the block of units it owns under static scheduling
   #pragma omp parallel shared(v) private(tid,mdp)
   {
 #ifdef USE_GPU
     checkCudaErrors(cudaSetDevice(gpu_id_local));
 #endif
     tid = omp_get_thread_num();
-    mdp = new MDUnit(tid + rank * num_threads, sinfo, pinfo);
-    #pragma omp critical
-    v.push_back(mdp);
+    for (int k = 0; k < units_per_thread; k++) {
+      mdp = new MDUnit(tid * units_per_thread + k + rank * num_units, sinfo, pinfo);
+      #pragma omp critical
+      v.push_back(mdp);
+    }
   }
-  mdv.resize(num_threads);
+  mdv.resize(num_units);
   for (unsigned int i = 0; i < v.size(); i++) {
     const int local_id = GetLocalID(v[i]->GetID());
     mdv[local_id] = v[i];
   }
+  unit_order.resize(num_units);
+  work_mark.resize(num_units, 0.0);
+  balance_mark.resize(num_units, 0.0);
+  unit_expired.resize(num_units, 0);
+  unit_energy.resize(num_units, 0.0);
+  unit_requests.resize(num_units * 4, MPI_REQUEST_NULL);
+  unit_counts.resize(num_units * 2, 0);
+  for (int i = 0; i < num_units; i++) {
+    unit_order[i] = i;
+  }
   s_time = 0.0;
 
 #ifdef USE_GPU
@@ -85,11 +298,41 @@ MDManager::MDManager(int &argc, char ** &argv) {
 }
 //----------------------------------------------------------------------
 MDManager::~MDManager(void) {
+  DiscardStepReduction();
+  if (reduction_steps > 0) {
+    mout << "# Reduction overlap: " << reduction_completed << "/" << reduction_steps
+         << " step(s) completed before the wait, mean window " << reduction_window / reduction_steps
+         << " s, mean wait " << reduction_wait / reduction_steps << " s" << std::endl;
+  }
+  if (NULL != snapshot_writer) {
+    FlushSnapshots();
+    const double exposed = snapshot_writer->GetStageTime() + snapshot_writer->GetStallTime();
+    const double work = snapshot_writer->GetWorkTime();
+    mout << "# AsyncSnapshot: " << snapshot_writer->GetSubmitted() << " snapshot(s), "
+         << snapshot_writer->GetFailed() << " failed, work " << work << " s, hidden "
+         << std::max(0.0, work - snapshot_writer->GetStallTime()) << " s, exposed " << exposed
+         << " s (staging " << snapshot_writer->GetStageTime() << " s, waiting "
+         << snapshot_writer->GetStallTime() << " s)" << std::endl;
+    delete snapshot_writer;
+  }
+  if (NULL != trajectory && trajectory->GetFrameNumber() > 0) {
+    mout << "# Trajectory: " << trajectory->GetFrameNumber() << " frame(s), "
+         << TrajectoryCodec::GetName(trajectory->GetCodec()) << ", compression ratio "
+         << trajectory->GetCompressionRatio() << " (vs. double), encoding "
+         << trajectory->GetEncodeRate() << " MB/s" << std::endl;
+  }
+  delete trajectory;
+  if (NULL != progress) {
+    mout << "# ProgressThread polls: " << progress->GetPolls() << std::endl;
+    delete progress;
+  }
   for (unsigned int i = 0; i < mdv.size(); i++) {
     delete mdv[i];
   }
   delete pinfo;
   delete sinfo;
+  delete balancer;
+  mout.Flush();
   MPI_Finalize();
 }
 //----------------------------------------------------------------------
@@ -100,71 +343,391 @@ MDManager::IsValid(void) {
 //----------------------------------------------------------------------
 bool
 MDManager::IsMyUnit(int id) {
-  return (rank == (id / num_threads));
+  return (rank == (id / num_units));
 }
 //----------------------------------------------------------------------
 int
 MDManager::GetLocalID(int id) {
-  return (id % num_threads);
+  return (id % num_units);
 }
 //----------------------------------------------------------------------
 void
 MDManager::SetInitialVelocity(double v0) {
-  for (int i = 0; i < num_threads; i++) {
+  DiscardStepReduction();
+  for (int i = 0; i < num_units; i++) {
     mdv[i]->SetInitialVelocity(v0);
   }
 }
 //----------------------------------------------------------------------
 void
 MDManager::SaveAsCdviewSequential(void) {
-  static int index = 0;
   char filename[256];
-  sprintf(filename, "conf%04d.cd", index);
-  index++;
-  SaveAsCdview(filename);
+  if (NULL != trajectory) {
+    SubmitSnapshot(trajectory);
+    return;
+  }
+  const bool binary = param.GetBooleanDef("CdviewBinary", false);
+  sprintf(filename, binary ? "conf%04d.chk" : "conf%04d.cd", cdview_frame);
+  cdview_frame++;
+  if (NULL != snapshot_writer) {
+    if (binary) {
+      SubmitSnapshot(new CheckpointSnapshotTask(filename), true);
+    } else {
+      SubmitSnapshot(new CdviewSnapshotTask(filename), true);
+    }
+  } else if (binary) {
+    SaveCheckpoint(filename);
+  } else {
+    SaveAsCdview(filename);
+  }
 }
 //----------------------------------------------------------------------
+// The units format their lines in parallel, and the blocks of all ranks
+// are written in rank order with one collective write.
+//----------------------------------------------------------------------
 void
 MDManager::SaveAsCdview(const char *filename) {
-  if (0 == GetRank()) {
-    std::ofstream ofs(filename);
-    ofs.close();
-  }
-  for (int r = 0; r < GetTotalProcs(); r++) {
-    Communicator::Barrier();
-    if (r == GetRank()) {
-      std::ofstream ofs(filename, std::ios::app);
-      for (int i = 0; i < num_threads; i++) {
-        mdv[i]->SaveAsCdview(ofs);
-      }
-      ofs.close();
-    }
+  std::vector<std::string> unit_buffer(num_units);
+  #pragma omp parallel for schedule(static)
+  for (int i = 0; i < num_units; i++) {
+    mdv[i]->SaveAsCdview(unit_buffer[i]);
+  }
+  std::vector<char> buffer;
+  for (int i = 0; i < num_units; i++) {
+    buffer.insert(buffer.end(), unit_buffer[i].begin(), unit_buffer[i].end());
+  }
+  if (!Communicator::WriteOrderedBytes(filename, buffer)) {
+    show_warning("Cannot open " << filename);
   }
 }
 //----------------------------------------------------------------------
 void
 MDManager::SaveConfiguration(void) {
   #pragma omp parallel for schedule(static)
-  for (int i = 0; i < num_threads; i++) {
+  for (int i = 0; i < num_units; i++) {
     mdv[i]->SaveConfiguration();
   }
 }
 //----------------------------------------------------------------------
 void
+MDManager::SaveCheckpoint(const char *filename, int keep) {
+  Snapshot s;
+  TakeSnapshot(s);
+  CheckpointSnapshotTask task(filename, keep);
+  if (!task.Process(s, MPI_COMM_WORLD)) {
+    show_warning("Cannot open the checkpoint file " << filename);
+    return;
+  }
+  mout << "# Checkpoint saved to " << filename << " (N = " << task.GetTotalParticleNumber() << ")" << std::endl;
+}
+//----------------------------------------------------------------------
+void
+MDManager::TakeSnapshot(Snapshot &s) {
+  for (int d = 0; d < 3; d++) {
+    s.L[d] = sinfo->L[d];
+  }
+  s.time = s_time;
+  s.zeta = mdv[0]->GetVariables()->Zeta;
+  s.step = step;
+  s.phase_step = phase_step;
+  s.phase = phase;
+  s.frame = cdview_frame;
+  s.counts.resize(num_units);
+  s.origins.resize(num_units * 3);
+  std::vector<int> offset(num_units + 1, 0);
+  for (int i = 0; i < num_units; i++) {
+    s.counts[i] = mdv[i]->GetParticleNumber();
+    offset[i + 1] = offset[i] + s.counts[i];
+    double *origin = mdv[i]->GetRect()->GetStartPosition();
+    for (int d = 0; d < 3; d++) {
+      s.origins[i * 3 + d] = origin[d];
+    }
+  }
+  s.records.resize(offset[num_units]);
+  #pragma omp parallel for schedule(static)
+  for (int i = 0; i < num_units; i++) {
+    Variables *vars = mdv[i]->GetVariables();
+    CheckpointRecord *r = s.records.data() + offset[i];
+    for (int j = 0; j < s.counts[i]; j++) {
+      for (int d = 0; d < 3; d++) {
+        r[j].q[d] = vars->q[j][d];
+        r[j].p[d] = vars->p[j][d];
+      }
+      r[j].type = vars->type[j];
+      r[j].reserved = 0;
+    }
+  }
+}
+//----------------------------------------------------------------------
+void
+MDManager::SubmitSnapshot(SnapshotTask *task, bool owned) {
+  if (NULL == snapshot_writer) {
+    Snapshot s;
+    TakeSnapshot(s);
+    if (!task->Process(s, MPI_COMM_WORLD)) {
+      show_warning("Snapshot task failed");
+    }
+    if (owned) delete task;
+    return;
+  }
+  Snapshot *s = snapshot_writer->Acquire();
+  TakeSnapshot(*s);
+  snapshot_writer->Submit(s, task, owned);
+}
+//----------------------------------------------------------------------
+void
+MDManager::FlushSnapshots(void) {
+  if (NULL != snapshot_writer) snapshot_writer->Flush();
+}
+//----------------------------------------------------------------------
+// Every rank reads an equal contiguous share of the particles, which are
+// then sent to the ranks owning their positions. The grid of the job
+// may thus differ from that of the writer. Returns false if the file
+// does not exist or does not match this system.
+// With resume, the step and the phase of the project and the number of
+// the next conf file are restored as well, and a system which the project has rescaled (ChangeScale) by
+// the same factor in all directions is rescaled again before the
+// particles are placed.
+//----------------------------------------------------------------------
+bool
+MDManager::LoadCheckpoint(const char *filename, bool resume) {
+  CheckpointFile file(filename, false);
+  if (!file.IsOpened()) return false;
+  CheckpointHeader header;
+  std::vector<int64_t> counts;
+  if (!file.ReadHeader(header, counts)) {
+    show_warning("Invalid checkpoint file " << filename);
+    return false;
+  }
+  const double alpha = header.L[X] / sinfo->L[X];
+  bool same = true;
+  bool scaled = resume;
+  for (int d = 0; d < 3; d++) {
+    if (fabs(header.L[d] - sinfo->L[d]) > 1e-10 * sinfo->L[d]) same = false;
+    if (fabs(header.L[d] - alpha * sinfo->L[d]) > 1e-10 * header.L[d]) scaled = false;
+  }
+  if (!same && !scaled) {
+    show_warning("The system size differs from the checkpoint " << filename);
+    return false;
+  }
+  const int64_t total = header.num_particles;
+  const int64_t start = total * rank / num_procs;
+  const int64_t end = total * (rank + 1) / num_procs;
+  std::vector<CheckpointRecord> records;
+  file.ReadRecords(start, end - start, records);
+
+  // The units are still empty, so only their geometry is rescaled.
+  // MDManager::ChangeScale would also make pair lists without particles.
+  if (!same) {
+    for (int d = 0; d < 3; d++) {
+      sinfo->L[d] *= alpha;
+    }
+    for (int i = 0; i < num_units; i++) {
+      mdv[i]->ChangeScale(alpha);
+    }
+    mout << "# Change Scale " << alpha << std::endl;
+  }
+  DiscardStepReduction();
+  pairlist_made = false;
+  expiry_ready = false;
+  DistributeParticles(records);
+  s_time = header.time;
+  for (int i = 0; i < num_units; i++) {
+    mdv[i]->GetVariables()->Zeta = header.zeta;
+  }
+  if (resume) {
+    step = header.step;
+    checked_step = step;
+    phase_step = header.phase_step;
+    phase = header.phase;
+    cdview_frame = header.frame;
+  }
+  const unsigned long int pn = GetTotalParticleNumber();
+  if (pn != static_cast<unsigned long int>(total)) {
+    show_warning("Lost " << total - static_cast<int64_t>(pn) << " particle(s) at restart");
+  }
+  mout << "# Restarted from " << filename << " (N = " << pn << ", written by "
+       << header.num_units << " unit(s))" << std::endl;
+  if (resume) {
+    mout << "# Resumed at step " << step << " (phase " << phase << ", "
+         << step - phase_step << " step(s) into it)" << std::endl;
+  }
+  return true;
+}
+//----------------------------------------------------------------------
+// InitialConfiguration=<file> replaces the configuration maker of a
+// project. Every rank reads its share of the file, and the particles go
+// to their units with one all-to-all. Returns false without the
+// parameter or on failure, so that the project makes its own state.
+// With Restart=yes, the checkpoint of a stopped job is taken first.
+//----------------------------------------------------------------------
+bool
+MDManager::LoadInitialConfiguration(double v0) {
+  if (param.GetBooleanDef("Restart", false) && LoadCheckpoint(checkpoint_file.c_str(), true)) {
+    return true;
+  }
+  const std::string filename = param.GetStringDef("InitialConfiguration", "");
+  if (filename == "") return false;
+  const int format = ConfigurationReader::GetFormat(filename, param.GetStringDef("InitialFormat", "auto"));
+  if (ConfigurationReader::CHECKPOINT == format) {
+    return LoadCheckpoint(filename.c_str());
+  }
+  if (ConfigurationReader::UNKNOWN == format) {
+    show_warning("Unknown format of " << filename << ", set InitialFormat");
+    return false;
+  }
+  const double t0 = Communicator::GetTime();
+  ConfigurationReader reader(filename.c_str(), format, param.GetIntegerDef("InitialFrame", -1), num_threads);
+  if (Communicator::AllReduceBoolean(!reader.IsOpened())) {
+    show_warning("Cannot open " << filename);
+    return false;
+  }
+  std::vector<CheckpointRecord> records;
+  const bool ok = reader.Read(rank, num_procs, records);
+  if (Communicator::AllReduceBoolean(!ok)) {
+    show_warning("Cannot read " << filename << ": " << reader.GetError());
+    return false;
+  }
+  if (reader.HasBox()) {
+    const double *L = reader.GetBox();
+    for (int d = 0; d < 3; d++) {
+      if (fabs(L[d] - sinfo->L[d]) > 1e-6 * sinfo->L[d]) {
+        show_warning("The system size differs from " << filename);
+        return false;
+      }
+    }
+  }
+  const unsigned long int total = Communicator::AllReduceUnsignedLongInteger(records.size());
+  if (reader.GetExpectedNumber() >= 0 && total != static_cast<unsigned long int>(reader.GetExpectedNumber())) {
+    show_warning("Read " << total << " of " << reader.GetExpectedNumber() << " particle(s) of " << filename);
+    return false;
+  }
+  const bool velocity = !Communicator::AllReduceBoolean(!reader.HasVelocity());
+
+  DiscardStepReduction();
+  pairlist_made = false;
+  expiry_ready = false;
+  DistributeParticles(records);
+  if (!velocity) {
+    SetInitialVelocity(v0);
+  }
+  const unsigned long int pn = GetTotalParticleNumber();
+  if (pn != total) {
+    show_warning("Lost " << total - pn << " particle(s) outside the system");
+  }
+  mout << "# Loaded " << pn << " particle(s) from " << filename << " ("
+       << ConfigurationReader::GetName(format) << ") in " << Communicator::GetTime() - t0
+       << " s" << std::endl;
+  return true;
+}
+//----------------------------------------------------------------------
+// The destination of a particle is the unit of the initial (uniform)
+// decomposition which contains it.
+//----------------------------------------------------------------------
+void
+MDManager::DistributeParticles(std::vector<CheckpointRecord> &records) {
+  int grid_size[D];
+  pinfo->GetGridSize(grid_size);
+  double ul[D];
+  for (int d = 0; d < 3; d++) {
+    ul[d] = sinfo->L[d] / static_cast<double>(grid_size[d]);
+  }
+  std::vector<int> dest(records.size());
+  std::vector<int> send_number(num_procs, 0);
+  for (unsigned int k = 0; k < records.size(); k++) {
+    for (int d = 0; d < 3; d++) {
+      double &x = records[k].q[d];
+      if (sinfo->IsPeriodic) {
+        if (x < 0.0) x += sinfo->L[d];
+        else if (x >= sinfo->L[d]) x -= sinfo->L[d];
+      }
+    }
+    dest[k] = GetUnitRank(FindUnit(records[k].q, ul, grid_size));
+    send_number[dest[k]]++;
+  }
+  std::vector<int> send_index(num_procs, 0);
+  for (int r = 1; r < num_procs; r++) {
+    send_index[r] = send_index[r - 1] + send_number[r - 1];
+  }
+  std::vector<CheckpointRecord> send_buffer(records.size());
+  for (unsigned int k = 0; k < records.size(); k++) {
+    send_buffer[send_index[dest[k]]++] = records[k];
+  }
+  std::vector<CheckpointRecord> recv_buffer;
+  Communicator::AllToAllVector(send_buffer, send_number, recv_buffer, num_procs);
+
+  // Received records are sorted by their unit, which adds them alone
+  const int rn = recv_buffer.size();
+  std::vector<int> unit(rn);
+  std::vector<int> unit_index(num_units + 1, 0);
+  #pragma omp parallel for schedule(static)
+  for (int k = 0; k < rn; k++) {
+    unit[k] = GetLocalID(FindUnit(recv_buffer[k].q, ul, grid_size));
+  }
+  for (int k = 0; k < rn; k++) {
+    unit_index[unit[k] + 1]++;
+  }
+  for (int i = 0; i < num_units; i++) {
+    unit_index[i + 1] += unit_index[i];
+  }
+  std::vector<int> order(rn);
+  std::vector<int> next(unit_index.begin(), unit_index.end() - 1);
+  for (int k = 0; k < rn; k++) {
+    order[next[unit[k]]++] = k;
+  }
+  #pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < num_units; i++) {
+    for (int j = unit_index[i]; j < unit_index[i + 1]; j++) {
+      const CheckpointRecord &r = recv_buffer[order[j]];
+      double x[D] = {r.q[X], r.q[Y], r.q[Z]};
+      double v[D] = {r.p[X], r.p[Y], r.p[Z]};
+      mdv[i]->AddParticle(x, v, r.type);
+    }
+  }
+}
+//----------------------------------------------------------------------
+// Unit of the uniform decomposition (unit length ul) containing x, with
+// the same rounding as the rect of MDUnit
+//----------------------------------------------------------------------
+int
+MDManager::FindUnit(const double x[3], const double ul[D], const int grid_size[D]) {
+  int pos[D];
+  for (int d = 0; d < 3; d++) {
+    int g = static_cast<int>(x[d] / ul[d]);
+    if (g > 0 && x[d] < ul[d] * static_cast<double>(g)) g--;
+    if (g < grid_size[d] - 1 && x[d] >= ul[d] * static_cast<double>(g) + ul[d]) g++;
+    pos[d] = std::min(std::max(g, 0), grid_size[d] - 1);
+  }
+  return pinfo->Pos2ID(pos);
+}
+//----------------------------------------------------------------------
+void
 MDManager::Calculate(void) {
+  CheckStop();
+  if (persistent_region && !IsBalanceStep()) {
+    CalculateInRegion(1);
+    return;
+  }
   static StopWatch swAll(GetRank(), "all");
   static StopWatch swForce(GetRank(), "force");
   static StopWatch swComm(GetRank(), "comm");
   static StopWatch swPair(GetRank(), "pair");
+  static StopWatch swBalance(GetRank(), "balance");
   swAll.Start();
-  if (IsPairListExpired()) {
+  if (reduction_pending) FinishStepReduction();
+  if (IsBalanceStep()) {
+    swBalance.Start();
+    BalanceLoad();
+    swBalance.Stop();
+  } else if (expiry_ready ? expiry_global : IsPairListExpired()) {
     //mout << "# " << GetSimulationTime() << " # Expired!" << std::endl;
     swPair.Start();
     MakePairList();
     swPair.Stop();
   }
-  #pragma omp parallel for schedule(static)
-  for (int i = 0; i < num_threads; i++) {
+  #pragma omp parallel for schedule(runtime)
+  for (int k = 0; k < num_units; k++) {
+    const int i = unit_order[k];
     mdv[i]->UpdatePositionHalf();
   }
   swComm.Start();
@@ -181,10 +744,242 @@ MDManager::Calculate(void) {
     CalculateForce();
     swForce.Stop();
   }
+  reduction_ready = false;
+  expiry_ready = false;
+  if (overlap_reduction) StartStepReduction();
   s_time += sinfo->TimeStep;
+  step++;
   swAll.Stop();
 }
 //----------------------------------------------------------------------
+void
+MDManager::CalculateSteps(const int n) {
+  int rest = n;
+  while (rest > 0) {
+    int m = 1;
+    if (persistent_region && !IsBalanceStep()) {
+      m = rest;
+      if (load_balance_interval > 0) {
+        m = std::min(m, load_balance_interval - step % load_balance_interval);
+      }
+      CheckStop();
+      m = std::min(m, GetStepsToCheck());
+      CalculateInRegion(m);
+    } else {
+      Calculate();
+    }
+    rest -= m;
+  }
+}
+//----------------------------------------------------------------------
+int
+MDManager::GetStepsToCheck(void) {
+  int m = INT_MAX;
+  if (stop_check_interval > 0) {
+    m = std::min(m, stop_check_interval - step % stop_check_interval);
+  }
+  if (checkpoint_interval > 0) {
+    m = std::min(m, checkpoint_interval - step % checkpoint_interval);
+  }
+  return m;
+}
+//----------------------------------------------------------------------
+// Called before every step, so that the project has written all of its
+// output for the steps taken when a checkpoint is saved. All ranks take
+// the same steps, so they check at the same one, and a single reduction
+// tells whether any of them got a signal or expects WallTime to run out
+// before the next check. The restart checkpoint is then written and
+// StopRequest unwinds the project. A step is checked once, and not at
+// all at the step a job starts or resumes from. A pending reduction is
+// finished before a checkpoint, which must hold the Zeta of the step.
+//----------------------------------------------------------------------
+void
+MDManager::CheckStop(void) {
+  if (step == checked_step) return;
+  checked_step = step;
+  if (stop_check_interval > 0 && step % stop_check_interval == 0) {
+    const double now = Communicator::GetTime();
+    const double interval = now - check_wall_time;
+    check_wall_time = now;
+    bool stop = (stop_signal != 0);
+    if (wall_time > 0.0 && now - start_wall_time + interval + wall_time_margin > wall_time) {
+      stop = true;
+    }
+    if (Communicator::AllReduceBoolean(stop)) {
+      mout << "# Stop at step " << step << " (t = " << s_time << ", "
+           << now - start_wall_time << " s elapsed)" << std::endl;
+      FlushSnapshots();
+      if (reduction_pending) FinishStepReduction();
+      SaveCheckpoint(checkpoint_file.c_str(), checkpoint_keep);
+      mout.Flush();
+      StopRequest r;
+      r.step = step;
+      r.time = s_time;
+      throw r;
+    }
+  }
+  if (checkpoint_interval > 0 && step % checkpoint_interval == 0) {
+    if (reduction_pending) FinishStepReduction();
+    SubmitSnapshot(new CheckpointSnapshotTask(checkpoint_file.c_str(), checkpoint_keep), true);
+  }
+}
+//----------------------------------------------------------------------
+// Nonblocking reductions: the pair-list check and the kinetic energy of
+// the next step are evaluated once a step is done, and their reduction
+// proceeds while the project observes or writes. The state they depend
+// on is not changed in between, except through the calls which discard
+// the reduction. The temperature is then recomputed, but the pair-list
+// check, which has charged the buffers, is kept unless the pair lists
+// are rebuilt or the particles moved.
+//----------------------------------------------------------------------
+void
+MDManager::StartStepReduction(void) {
+  const bool nose_hoover = sinfo->ControlTemperature && sinfo->HeatbathType == HT_NOSEHOOVER;
+  KineticEnergyObserver obs;
+  #pragma omp parallel for schedule(runtime)
+  for (int k = 0; k < num_units; k++) {
+    const int i = unit_order[k];
+    unit_expired[i] = mdv[i]->IsPairListExpired();
+    unit_energy[i] = nose_hoover ? mdv[i]->ObserveDouble(&obs) : 0.0;
+  }
+  reduction_local[0] = 0.0;
+  reduction_local[1] = 0.0;
+  reduction_local[2] = 0.0;
+  for (int i = 0; i < num_units; i++) {
+    reduction_local[0] += unit_expired[i] ? 1.0 : 0.0;
+    reduction_local[1] += unit_energy[i];
+    reduction_local[2] += static_cast<double>(mdv[i]->GetParticleNumber());
+  }
+  Communicator::IAllReduceDoubleBuffer(reduction_local, 3, reduction_global, reduction_request);
+  reduction_pending = true;
+  reduction_post_time = Communicator::GetTime();
+}
+//----------------------------------------------------------------------
+void
+MDManager::FinishStepReduction(void) {
+  static StopWatch swWait(GetRank(), "reduction_wait");
+  // The overlap of each step is judged by whether the reduction is done
+  // when it is needed
+  const double t = Communicator::GetTime();
+  swWait.Start();
+  if (Communicator::Test(reduction_request)) {
+    reduction_completed++;
+  } else {
+    Communicator::WaitAll(1, &reduction_request);
+  }
+  swWait.Stop();
+  reduction_steps++;
+  reduction_window += t - reduction_post_time;
+  reduction_wait += Communicator::GetTime() - t;
+  reduction_pending = false;
+  reduction_ready = true;
+  expiry_ready = true;
+  expiry_global = reduction_global[0] > 0.0;
+  if (sinfo->ControlTemperature && sinfo->HeatbathType == HT_NOSEHOOVER) {
+    const double t = GetReducedTemperature();
+    for (int i = 0; i < num_units; i++) {
+      mdv[i]->HeatbathZeta(t);
+    }
+  }
+}
+//----------------------------------------------------------------------
+void
+MDManager::DiscardStepReduction(void) {
+  if (reduction_pending) FinishStepReduction();
+  reduction_ready = false;
+}
+//----------------------------------------------------------------------
+// Persistent parallel region: n steps run inside one parallel region.
+// The per-unit phases are orphaned worksharing loops and the MPI stages
+// are done by the master thread in between, so that a step costs a few
+// barriers instead of a fork/join per loop. The loop closing a step
+// also checks the pair lists for the next one.
+//----------------------------------------------------------------------
+void
+MDManager::CalculateInRegion(const int n) {
+  static StopWatch swRegion(GetRank(), "region");
+  swRegion.Start();
+  // The check closing a step is carried to the next one, also across
+  // regions, since every check charges the buffer of the pair lists
+  bool expired = expiry_global;
+  const bool check = !expiry_ready;
+  #pragma omp parallel
+  {
+    if (check) {
+      #pragma omp for schedule(runtime)
+      for (int k = 0; k < num_units; k++) {
+        const int i = unit_order[k];
+        unit_expired[i] = mdv[i]->IsPairListExpired();
+      }
+      #pragma omp master
+      expired = IsAnyUnitExpired();
+      #pragma omp barrier
+    }
+    for (int s = 0; s < n; s++) {
+      if (expired) MakePairListInRegion();
+      #pragma omp for schedule(runtime)
+      for (int k = 0; k < num_units; k++) {
+        const int i = unit_order[k];
+        mdv[i]->UpdatePositionHalf();
+      }
+      SendBorderParticlesInRegion();
+      if (sinfo->ControlTemperature && sinfo->HeatbathType == HT_NOSEHOOVER) {
+        double t = TemperatureInRegion();
+        #pragma omp for schedule(runtime)
+        for (int k = 0; k < num_units; k++) {
+          const int i = unit_order[k];
+          mdv[i]->HeatbathZeta(t);
+          mdv[i]->HeatbathMomenta();
+          mdv[i]->CalculateForce();
+          if (!sinfo->HalfShell) mdv[i]->HeatbathMomenta();
+        }
+        if (sinfo->HalfShell) {
+          SendBorderMomentaInRegion();
+          #pragma omp for schedule(static)
+          for (int i = 0; i < num_units; i++) {
+            mdv[i]->HeatbathMomenta();
+          }
+        }
+        t = TemperatureInRegion();
+        #pragma omp for schedule(runtime)
+        for (int k = 0; k < num_units; k++) {
+          const int i = unit_order[k];
+          mdv[i]->HeatbathZeta(t);
+          mdv[i]->UpdatePositionHalf();
+          unit_expired[i] = mdv[i]->IsPairListExpired();
+        }
+      } else {
+        #pragma omp for schedule(runtime)
+        for (int k = 0; k < num_units; k++) {
+          const int i = unit_order[k];
+          mdv[i]->CalculateForce();
+        }
+        if (sinfo->HalfShell) SendBorderMomentaInRegion();
+        #pragma omp for schedule(runtime)
+        for (int k = 0; k < num_units; k++) {
+          const int i = unit_order[k];
+          if (sinfo->ControlTemperature) {
+            mdv[i]->Langevin();
+          } else {
+            mdv[i]->UpdatePositionHalf();
+          }
+          unit_expired[i] = mdv[i]->IsPairListExpired();
+        }
+      }
+      #pragma omp master
+      expired = IsAnyUnitExpired();
+      #pragma omp barrier
+    }
+  }
+  expiry_ready = true;
+  expiry_global = expired;
+  for (int s = 0; s < n; s++) {
+    s_time += sinfo->TimeStep;
+    step++;
+  }
+  swRegion.Stop();
+}
+//----------------------------------------------------------------------
 #ifdef USE_GPU
 #define GPU_CUDA_ENTER                                      \
   static StopWatch swForce_cpu(GetRank(), "force_cpu");     \
@@ -231,22 +1026,26 @@ MDManager::CalculateForce(void) {
 
   // calculate @ GPU
   GPU_CUDA_ENTER;
-  for (int i = 0; i < num_threads; i++) {
+  for (int i = 0; i < num_units; i++) {
     INNER_LOOP_TEMPLATE_GPU(LOOP_BODY_INNER(GPU));
   }
   GPU_TIMER_STOP;
 
   // calculate @ CPU
-  #pragma omp parallel for schedule(static)
-  for (int i = 0; i < num_threads; i++) {
+  #pragma omp parallel for schedule(runtime)
+  for (int k = 0; k < num_units; k++) {
+    const int i = unit_order[k];
     LOOP_BODY_INNER(HOST_NAME);
   }
 
   // sync CPU and GPU
   GPU_CUDA_EXIT;
 
-  #pragma omp parallel for schedule(static)
-  for (int i = 0; i < num_threads; i++) {
+  if (sinfo->HalfShell) SendBorderMomenta();
+
+  #pragma omp parallel for schedule(runtime)
+  for (int k = 0; k < num_units; k++) {
+    const int i = unit_order[k];
     mdv[i]->UpdatePositionHalf();
   }
 }
@@ -257,30 +1056,50 @@ MDManager::CalculateNoseHoover(void) {
 #define LOOP_BODY_INNER(DEVICE_T)                     \
   MDACP_CONCAT(mdv[i]->HeatbathMomenta, DEVICE_T)();  \
   MDACP_CONCAT(mdv[i]->CalculateForce, DEVICE_T)();   \
-  MDACP_CONCAT(mdv[i]->HeatbathMomenta, DEVICE_T)()
+  if (!sinfo->HalfShell) MDACP_CONCAT(mdv[i]->HeatbathMomenta, DEVICE_T)()
 
-  double t = Temperature();
-  for (int i = 0; i < num_threads; i++) { mdv[i]->HeatbathZeta(t); }
+  double t = reduction_ready ? GetReducedTemperature() : Temperature();
+  for (int i = 0; i < num_units; i++) { mdv[i]->HeatbathZeta(t); }
 
   // calculate @ GPU
   GPU_CUDA_ENTER;
-  for (int i = 0; i < num_threads; i++) {
+  for (int i = 0; i < num_units; i++) {
     INNER_LOOP_TEMPLATE_GPU(LOOP_BODY_INNER(GPU));
   }
   GPU_TIMER_STOP;
 
   // calculate @ CPU
-  #pragma omp parallel for schedule(static)
-  for (int i = 0; i < num_threads; i++) {
+  #pragma omp parallel for schedule(runtime)
+  for (int k = 0; k < num_units; k++) {
+    const int i = unit_order[k];
     LOOP_BODY_INNER(HOST_NAME);
   }
 
   // sync CPU and GPU
   GPU_CUDA_EXIT;
 
+  if (sinfo->HalfShell) {
+    SendBorderMomenta();
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < num_units; i++) {
+      mdv[i]->HeatbathMomenta();
+    }
+  }
+
+  // With NonblockingReduction this temperature is reduced after the step
+  // and HeatbathZeta is applied in FinishStepReduction.
+  if (overlap_reduction) {
+    #pragma omp parallel for schedule(runtime)
+    for (int k = 0; k < num_units; k++) {
+      const int i = unit_order[k];
+      mdv[i]->UpdatePositionHalf();
+    }
+    return;
+  }
   t = Temperature();
-  #pragma omp parallel for schedule(static)
-  for (int i = 0; i < num_threads; i++) {
+  #pragma omp parallel for schedule(runtime)
+  for (int k = 0; k < num_units; k++) {
+    const int i = unit_order[k];
     mdv[i]->HeatbathZeta(t);
     mdv[i]->UpdatePositionHalf();
   }
@@ -294,22 +1113,26 @@ MDManager::CalculateLangevin(void) {
 
   // calculate @ GPU
   GPU_CUDA_ENTER;
-  for (int i = 0; i < num_threads; i++) {
+  for (int i = 0; i < num_units; i++) {
     INNER_LOOP_TEMPLATE_GPU(LOOP_BODY_INNER(GPU));
   }
   GPU_TIMER_STOP;
 
   // calculate @ CPU
-  #pragma omp parallel for schedule(static)
-  for (int i = 0; i < num_threads; i++) {
+  #pragma omp parallel for schedule(runtime)
+  for (int k = 0; k < num_units; k++) {
+    const int i = unit_order[k];
     LOOP_BODY_INNER(HOST_NAME);
   }
 
   // sync CPU and GPU
   GPU_CUDA_EXIT;
 
-  #pragma omp parallel for schedule(static)
-  for (int i = 0; i < num_threads; i++) {
+  if (sinfo->HalfShell) SendBorderMomenta();
+
+  #pragma omp parallel for schedule(runtime)
+  for (int k = 0; k < num_units; k++) {
+    const int i = unit_order[k];
     mdv[i]->Langevin();
   }
 }
@@ -318,25 +1141,22 @@ void
 MDManager::SendParticlesSub(const int dir) {
   const int o_dir = OppositeDir[dir];
   debug_printf("dir = %s o_dir = %s\n", Direction::Name(dir), Direction::Name(o_dir));
-  #pragma omp parallel for schedule(static)
-  for (int i = 0; i < num_threads; i++) {
-    mdv[i]->MakeBufferForSendingParticle(dir);
-  }
   std::vector<int> send_number;
   std::vector<int> recv_number;
   std::vector<ParticleInfo> send_buffer;
   std::vector<ParticleInfo> recv_buffer;
-  for (int i = 0; i < num_threads; i++) {
+  for (int i = 0; i < num_units; i++) {
     const int id = mdv[i]->GetID();
     const int id_dest = pinfo->GetNeighborID(id, dir);
     const int id_src = pinfo->GetNeighborID(id, o_dir);
     if (IsMyUnit(id_src)) {
       const int local_id_src  = GetLocalID(id_src);
-      mdv[i]->ReceiveParticles(mdv[local_id_src]->send_buffer);
+      mdv[i]->ReceiveMigratingParticles(dir, mdv[local_id_src]->migration_buffer[dir]);
     }
     if (!IsMyUnit(id_dest)) {
-      send_number.push_back(mdv[i]->send_buffer.size());
-      send_buffer.insert(send_buffer.end(), mdv[i]->send_buffer.begin(), mdv[i]->send_buffer.end());
+      std::vector<ParticleInfo> &buffer = mdv[i]->migration_buffer[dir];
+      send_number.push_back(buffer.size());
+      send_buffer.insert(send_buffer.end(), buffer.begin(), buffer.end());
     }
   }
   const int dest_rank = pinfo->GetNeighborRank(rank, dir);
@@ -358,7 +1178,7 @@ MDManager::SendParticlesSub(const int dir) {
   std::vector<ParticleInfo>::iterator it2 = recv_buffer.begin();
   int index = 0;
   std::vector<ParticleInfo> temp_buffer;
-  for (int i = 0; i < num_threads; i++) {
+  for (int i = 0; i < num_units; i++) {
     const int id = mdv[i]->GetID();
     const int id_src = pinfo->GetNeighborID(id, o_dir);
     if (IsMyUnit(id_src)) {
@@ -369,44 +1189,50 @@ MDManager::SendParticlesSub(const int dir) {
     index++;
     temp_buffer.clear();
     temp_buffer.insert(temp_buffer.begin(), it1, it2);
-    mdv[i]->ReceiveParticles(temp_buffer);
+    mdv[i]->ReceiveMigratingParticles(dir, temp_buffer);
   }
 }
 //----------------------------------------------------------------------
 void
 MDManager::SendParticles(void) {
-  for (int dir = 0; dir < MAX_DIR; dir++) {
-    SendParticlesSub(dir);
-  }
-  #pragma omp parallel for schedule(static)
-  for (int i = 0; i < num_threads; i++) {
-    mdv[i]->AdjustPeriodicBoundary();
-  }
+  #pragma omp parallel
+  SendParticlesInRegion();
 }
 //----------------------------------------------------------------------
 void
-MDManager::MakePairList(void) {
-  SendParticles();
-  #pragma omp parallel for schedule(static)
-  for (int i = 0; i < num_threads; i++) {
-    const int pn = mdv[i]->GetParticleNumber();
-    mdv[i]->SetTotalParticleNumber(pn);
+MDManager::SendParticlesInRegion(void) {
+  #pragma omp for schedule(runtime)
+  for (int k = 0; k < num_units; k++) {
+    const int i = unit_order[k];
+    mdv[i]->MakeBufferForMigration();
   }
-  for (int dir = 0; dir < MAX_DIR; dir++) {
-    #pragma omp parallel for schedule(static)
-    for (int i = 0; i < num_threads; i++) {
-      mdv[i]->FindBorderParticles(dir);
+  if (thread_multiple) {
+    for (int dir = 0; dir < MAX_DIR; dir++) {
+      SendParticlesPerUnit(dir);
     }
-    SendBorderParticlesSub(dir);
+  } else {
+    #pragma omp master
+    for (int dir = 0; dir < MAX_DIR; dir++) {
+      SendParticlesSub(dir);
+    }
+    #pragma omp barrier
   }
-  #pragma omp parallel for schedule(static)
-  for (int i = 0; i < num_threads; i++) {
-    mdv[i]->MakePairList();
+  #pragma omp for schedule(static)
+  for (int i = 0; i < num_units; i++) {
+    mdv[i]->AdjustPeriodicBoundary();
   }
+}
+//----------------------------------------------------------------------
+void
+MDManager::MakePairList(void) {
+  DiscardStepReduction();
+  #pragma omp parallel
+  MakePairListInRegion();
+  expiry_ready = false;
 
 #ifdef USE_GPU
   AdjustCPUGPUWorkBalance();
-  for (int i = 0; i < num_threads; i++) {
+  for (int i = 0; i < num_units; i++) {
     mdv[i]->SendNeighborInfoToGPUAsync();
 #if !defined(GPU_ARCH_PASCAL)
     mdv[i]->TransposeSortedList();
@@ -417,36 +1243,131 @@ MDManager::MakePairList(void) {
 }
 //----------------------------------------------------------------------
 void
-MDManager::SendBorderParticles(void) {
-  #pragma omp parallel for schedule(static)
-  for (int i = 0; i < num_threads; i++) {
-    const int pn = mdv[i]->GetParticleNumber();
-    mdv[i]->SetTotalParticleNumber(pn);
+MDManager::MakePairListInRegion(void) {
+  SendParticlesInRegion();
+  if (overlap_interior_pairs) {
+    MakePairListOverlapped();
+  } else {
+    #pragma omp for schedule(runtime)
+    for (int k = 0; k < num_units; k++) {
+      const int i = unit_order[k];
+      const int pn = mdv[i]->GetParticleNumber();
+      mdv[i]->SetTotalParticleNumber(pn);
+      mdv[i]->FindBorderCandidates();
+    }
+    const int num_dir = GetBorderDirections();
+    for (int dir = 0; dir < num_dir; dir++) {
+      #pragma omp for schedule(runtime)
+      for (int k = 0; k < num_units; k++) {
+        const int i = unit_order[k];
+        mdv[i]->FindBorderParticles(dir);
+        mdv[i]->MakeBufferForBorderParticles(dir);
+      }
+      if (thread_multiple) {
+        ExchangeBorderParticlesPerUnit(dir);
+      } else {
+        #pragma omp master
+        ExchangeBorderParticles(dir);
+        #pragma omp barrier
+      }
+    }
+    #pragma omp for schedule(runtime)
+    for (int k = 0; k < num_units; k++) {
+      const int i = unit_order[k];
+      mdv[i]->MakePairList();
+    }
+  }
+  if (work_stealing) {
+    #pragma omp single
+    UpdateUnitOrder();
+  }
+  // Also for the rebuilds of CalculateInRegion
+  #pragma omp master
+  pairlist_made = true;
+}
+//----------------------------------------------------------------------
+// The master thread exchanges the ghosts of all units stage by stage
+// while the others search the pairs of own particles, which do not
+// depend on the ghosts. The pairs with ghosts are searched after the
+// exchange. The rebuild itself still stops the time steps: the list is
+// not built ahead of time on a helper thread, and there is no second
+// list to swap in, since a list indexes the particle layout made by the
+// migration and the ghost set of the current skin. The split search
+// costs more than a single one, so this only pays when the exchange
+// waits for other ranks and the threads would otherwise be idle.
+//----------------------------------------------------------------------
+void
+MDManager::MakePairListOverlapped(void) {
+  #pragma omp for schedule(runtime)
+  for (int k = 0; k < num_units; k++) {
+    mdv[unit_order[k]]->PrepareInteriorPairList();
+  }
+  const int num_dir = GetBorderDirections();
+  #pragma omp master
+  for (int dir = 0; dir < num_dir; dir++) {
+    for (int i = 0; i < num_units; i++) {
+      mdv[i]->FindBorderParticles(dir);
+      mdv[i]->MakeBufferForBorderParticles(dir);
+    }
+    ExchangeBorderParticles(dir);
   }
-  for (int dir = 0; dir < MAX_DIR; dir++) {
-    SendBorderParticlesSub(dir);
+  #pragma omp for schedule(dynamic) nowait
+  for (int k = 0; k < num_units; k++) {
+    mdv[unit_order[k]]->MakeInteriorPairList();
   }
+  #pragma omp barrier
+  #pragma omp for schedule(runtime)
+  for (int k = 0; k < num_units; k++) {
+    mdv[unit_order[k]]->MakeBorderPairList();
+  }
+}
+//----------------------------------------------------------------------
+void
+MDManager::SendBorderParticles(void) {
+  #pragma omp parallel
+  SendBorderParticlesInRegion();
 }
 //----------------------------------------------------------------------
 void
-MDManager::SendBorderParticlesSub(const int dir) {
+MDManager::SendBorderParticlesInRegion(void) {
+  const int num_dir = GetBorderDirections();
+  for (int dir = 0; dir < num_dir; dir++) {
+    #pragma omp for schedule(runtime)
+    for (int k = 0; k < num_units; k++) {
+      const int i = unit_order[k];
+      if (dir == 0) {
+        const int pn = mdv[i]->GetParticleNumber();
+        mdv[i]->SetTotalParticleNumber(pn);
+      }
+      mdv[i]->MakeBufferForBorderParticles(dir);
+    }
+    if (thread_multiple) {
+      ExchangeBorderParticlesPerUnit(dir);
+    } else {
+      #pragma omp master
+      ExchangeBorderParticles(dir);
+      #pragma omp barrier
+    }
+  }
+}
+//----------------------------------------------------------------------
+// Receive the border particles packed by MakeBufferForBorderParticles
+//----------------------------------------------------------------------
+void
+MDManager::ExchangeBorderParticles(const int dir) {
   const int o_dir = OppositeDir[dir];
   debug_printf("dir = %s o_dir = %s\n", Direction::Name(dir), Direction::Name(o_dir));
-  #pragma omp parallel for schedule(static)
-  for (int i = 0; i < num_threads; i++) {
-    mdv[i]->MakeBufferForBorderParticles(dir);
-  }
   std::vector<int> send_number;
   std::vector<int> recv_number;
   std::vector<ParticleInfo> send_buffer;
   std::vector<ParticleInfo> recv_buffer;
-  for (int i = 0; i < num_threads; i++) {
+  for (int i = 0; i < num_units; i++) {
     const int id = mdv[i]->GetID();
     const int id_dest = pinfo->GetNeighborID(id, dir);
     const int id_src = pinfo->GetNeighborID(id, o_dir);
     if (IsMyUnit(id_src)) {
       const int local_id_src  = GetLocalID(id_src);
-      mdv[i]->ReceiveBorderParticles(mdv[local_id_src]->send_buffer);
+      mdv[i]->ReceiveBorderParticles(dir, mdv[local_id_src]->send_buffer);
     }
     if (!IsMyUnit(id_dest)) {
       send_number.push_back(mdv[i]->send_buffer.size());
@@ -473,7 +1394,7 @@ MDManager::SendBorderParticlesSub(const int dir) {
   std::vector<ParticleInfo>::iterator it2 = recv_buffer.begin();
   int index = 0;
   std::vector<ParticleInfo> temp_buffer;
-  for (int i = 0; i < num_threads; i++) {
+  for (int i = 0; i < num_units; i++) {
     const int id = mdv[i]->GetID();
     const int id_src = pinfo->GetNeighborID(id, o_dir);
     if (IsMyUnit(id_src)) {
@@ -483,11 +1404,228 @@ MDManager::SendBorderParticlesSub(const int dir) {
     it2 += recv_number[index];
     temp_buffer.clear();
     temp_buffer.insert(temp_buffer.begin(), it1, it2);
-    mdv[i]->ReceiveBorderParticles(temp_buffer);
+    mdv[i]->ReceiveBorderParticles(dir, temp_buffer);
     index++;
   }
 }
 //----------------------------------------------------------------------
+// Make the ghosts consistent with the current positions before an
+// observation over pairs. The pair list is kept: Calculate checks it at
+// every step, so it is rebuilt only if none has been made since the
+// particles were last set by ExecuteAll.
+//----------------------------------------------------------------------
+void
+MDManager::UpdateBorderParticles(void) {
+  if (pairlist_made) {
+    SendBorderParticles();
+  } else {
+    MakePairList();
+  }
+}
+//----------------------------------------------------------------------
+// Reverse halo for half-shell mode: momenta accumulated on ghosts are
+// sent back to their owners in the reverse order of SendBorderParticles.
+//----------------------------------------------------------------------
+void
+MDManager::SendBorderMomenta(void) {
+  #pragma omp parallel
+  SendBorderMomentaInRegion();
+}
+//----------------------------------------------------------------------
+void
+MDManager::SendBorderMomentaInRegion(void) {
+  for (int dir = GetBorderDirections() - 1; dir >= 0; dir--) {
+    #pragma omp for schedule(static)
+    for (int i = 0; i < num_units; i++) {
+      mdv[i]->MakeBufferForBorderMomenta(dir);
+    }
+    if (thread_multiple) {
+      ExchangeBorderMomentaPerUnit(dir);
+    } else {
+      #pragma omp master
+      ExchangeBorderMomenta(dir);
+      #pragma omp barrier
+    }
+  }
+}
+//----------------------------------------------------------------------
+void
+MDManager::ExchangeBorderMomenta(const int dir) {
+  const int o_dir = OppositeDir[dir];
+  std::vector<double> send_buffer;
+  std::vector<double> recv_buffer;
+  int recv_sum = 0;
+  for (int i = 0; i < num_units; i++) {
+    const int id = mdv[i]->GetID();
+    const int id_dest = pinfo->GetNeighborID(id, dir);
+    const int id_src = pinfo->GetNeighborID(id, o_dir);
+    if (IsMyUnit(id_dest)) {
+      const int local_id_dest = GetLocalID(id_dest);
+      mdv[i]->ReceiveBorderMomenta(dir, mdv[local_id_dest]->momentum_buffer.data());
+    } else {
+      recv_sum += mdv[i]->GetBorderParticleNumber(dir) * 3;
+    }
+    if (!IsMyUnit(id_src)) {
+      send_buffer.insert(send_buffer.end(), mdv[i]->momentum_buffer.begin(), mdv[i]->momentum_buffer.end());
+    }
+  }
+  const int dest_rank = pinfo->GetNeighborRank(rank, dir);
+  const int src_rank = pinfo->GetNeighborRank(rank, o_dir);
+  const int send_sum = send_buffer.size();
+  Communicator::SendRecvVector(send_buffer, send_sum, src_rank, recv_buffer, recv_sum, dest_rank);
+
+  int index = 0;
+  for (int i = 0; i < num_units; i++) {
+    const int id = mdv[i]->GetID();
+    const int id_dest = pinfo->GetNeighborID(id, dir);
+    if (IsMyUnit(id_dest)) {
+      continue;
+    }
+    mdv[i]->ReceiveBorderMomenta(dir, recv_buffer.data() + index);
+    index += mdv[i]->GetBorderParticleNumber(dir) * 3;
+  }
+}
+//----------------------------------------------------------------------
+// Per-unit exchange with ThreadMultiple: every unit sends and receives
+// its own face messages, tagged by the local ID of the receiving unit.
+// Every request of a stage is posted before any thread waits, so that a
+// thread blocked on one unit never holds back a message that another
+// rank is waiting for. These must be called by all threads of a region.
+//----------------------------------------------------------------------
+int
+MDManager::GetUnitTag(const int local_id, const int dir, const int kind) {
+  return (local_id * MAX_DIR + dir) * 2 + kind;
+}
+//----------------------------------------------------------------------
+void
+MDManager::PostUnitCounts(const int i, const int dir, const int send_number) {
+  const int o_dir = OppositeDir[dir];
+  const int id = mdv[i]->GetID();
+  const int id_dest = pinfo->GetNeighborID(id, dir);
+  const int id_src = pinfo->GetNeighborID(id, o_dir);
+  MPI_Request *req = &unit_requests[i * 4];
+  for (int r = 0; r < 4; r++) {
+    req[r] = MPI_REQUEST_NULL;
+  }
+  if (!IsMyUnit(id_src)) {
+    Communicator::IRecvBytes(&unit_counts[i * 2 + 1], sizeof(int), GetUnitRank(id_src),
+                             GetUnitTag(i, dir, 0), req[0]);
+  }
+  if (!IsMyUnit(id_dest)) {
+    unit_counts[i * 2] = send_number;
+    Communicator::ISendBytes(&unit_counts[i * 2], sizeof(int), GetUnitRank(id_dest),
+                             GetUnitTag(GetLocalID(id_dest), dir, 0), req[1]);
+  }
+}
+//----------------------------------------------------------------------
+void
+MDManager::PostUnitParticles(const int i, const int dir, std::vector<ParticleInfo> &send_buffer) {
+  const int o_dir = OppositeDir[dir];
+  const int id = mdv[i]->GetID();
+  const int id_dest = pinfo->GetNeighborID(id, dir);
+  const int id_src = pinfo->GetNeighborID(id, o_dir);
+  MPI_Request *req = &unit_requests[i * 4];
+  Communicator::WaitAll(2, req);
+  if (!IsMyUnit(id_src)) {
+    std::vector<ParticleInfo> &recv_buffer = mdv[i]->recv_buffer;
+    recv_buffer.resize(unit_counts[i * 2 + 1]);
+    Communicator::IRecvBytes(recv_buffer.data(), recv_buffer.size() * sizeof(ParticleInfo),
+                             GetUnitRank(id_src), GetUnitTag(i, dir, 1), req[2]);
+  }
+  if (!IsMyUnit(id_dest)) {
+    Communicator::ISendBytes(send_buffer.data(), send_buffer.size() * sizeof(ParticleInfo),
+                             GetUnitRank(id_dest), GetUnitTag(GetLocalID(id_dest), dir, 1), req[3]);
+  }
+}
+//----------------------------------------------------------------------
+void
+MDManager::SendParticlesPerUnit(const int dir) {
+  #pragma omp for schedule(runtime)
+  for (int k = 0; k < num_units; k++) {
+    const int i = unit_order[k];
+    PostUnitCounts(i, dir, mdv[i]->migration_buffer[dir].size());
+  }
+  #pragma omp for schedule(runtime)
+  for (int k = 0; k < num_units; k++) {
+    const int i = unit_order[k];
+    PostUnitParticles(i, dir, mdv[i]->migration_buffer[dir]);
+  }
+  #pragma omp for schedule(runtime)
+  for (int k = 0; k < num_units; k++) {
+    const int i = unit_order[k];
+    Communicator::WaitAll(2, &unit_requests[i * 4 + 2]);
+    const int id_src = pinfo->GetNeighborID(mdv[i]->GetID(), OppositeDir[dir]);
+    if (IsMyUnit(id_src)) {
+      mdv[i]->ReceiveMigratingParticles(dir, mdv[GetLocalID(id_src)]->migration_buffer[dir]);
+    } else {
+      mdv[i]->ReceiveMigratingParticles(dir, mdv[i]->recv_buffer);
+    }
+  }
+}
+//----------------------------------------------------------------------
+void
+MDManager::ExchangeBorderParticlesPerUnit(const int dir) {
+  #pragma omp for schedule(runtime)
+  for (int k = 0; k < num_units; k++) {
+    const int i = unit_order[k];
+    PostUnitCounts(i, dir, mdv[i]->send_buffer.size());
+  }
+  #pragma omp for schedule(runtime)
+  for (int k = 0; k < num_units; k++) {
+    const int i = unit_order[k];
+    PostUnitParticles(i, dir, mdv[i]->send_buffer);
+  }
+  #pragma omp for schedule(runtime)
+  for (int k = 0; k < num_units; k++) {
+    const int i = unit_order[k];
+    Communicator::WaitAll(2, &unit_requests[i * 4 + 2]);
+    const int id_src = pinfo->GetNeighborID(mdv[i]->GetID(), OppositeDir[dir]);
+    if (IsMyUnit(id_src)) {
+      mdv[i]->ReceiveBorderParticles(dir, mdv[GetLocalID(id_src)]->send_buffer);
+    } else {
+      mdv[i]->ReceiveBorderParticles(dir, mdv[i]->recv_buffer);
+    }
+  }
+}
+//----------------------------------------------------------------------
+// The momentum sizes are known from the border particles of both sides
+//----------------------------------------------------------------------
+void
+MDManager::ExchangeBorderMomentaPerUnit(const int dir) {
+  #pragma omp for schedule(runtime)
+  for (int k = 0; k < num_units; k++) {
+    const int i = unit_order[k];
+    const int id = mdv[i]->GetID();
+    const int id_dest = pinfo->GetNeighborID(id, dir);
+    const int id_src = pinfo->GetNeighborID(id, OppositeDir[dir]);
+    MPI_Request *req = &unit_requests[i * 4];
+    req[0] = MPI_REQUEST_NULL;
+    req[1] = MPI_REQUEST_NULL;
+    if (!IsMyUnit(id_dest)) {
+      std::vector<double> &recv_buffer = mdv[i]->momentum_recv_buffer;
+      recv_buffer.resize(mdv[i]->GetBorderParticleNumber(dir) * 3);
+      Communicator::IRecvBytes(recv_buffer.data(), recv_buffer.size() * sizeof(double),
+                               GetUnitRank(id_dest), GetUnitTag(i, dir, 0), req[0]);
+    }
+    if (!IsMyUnit(id_src)) {
+      std::vector<double> &send_buffer = mdv[i]->momentum_buffer;
+      Communicator::ISendBytes(send_buffer.data(), send_buffer.size() * sizeof(double),
+                               GetUnitRank(id_src), GetUnitTag(GetLocalID(id_src), dir, 0), req[1]);
+    }
+  }
+  #pragma omp for schedule(runtime)
+  for (int k = 0; k < num_units; k++) {
+    const int i = unit_order[k];
+    Communicator::WaitAll(2, &unit_requests[i * 4]);
+    const int id_dest = pinfo->GetNeighborID(mdv[i]->GetID(), dir);
+    if (IsMyUnit(id_dest)) {
+      mdv[i]->ReceiveBorderMomenta(dir, mdv[GetLocalID(id_dest)]->momentum_buffer.data());
+    } else {
+      mdv[i]->ReceiveBorderMomenta(dir, mdv[i]->momentum_recv_buffer.data());
+    }
+  }
+}
+//----------------------------------------------------------------------
 void
 MDManager::ShowSystemInformation(void) {
   const unsigned long int pn = GetTotalParticleNumber();
@@ -499,7 +1637,7 @@ MDManager::ShowSystemInformation(void) {
 unsigned long int
 MDManager::GetTotalParticleNumber(void) {
   unsigned long int pn = 0;
-  for (int i = 0; i < num_threads; i++) {
+  for (int i = 0; i < num_units; i++) {
     pn += static_cast<unsigned long int>(mdv[i]->GetParticleNumber());
   }
   pn = Communicator::AllReduceUnsignedLongInteger(pn);
@@ -510,18 +1648,55 @@ bool
 MDManager::IsPairListExpired(void) {
   bool expired = false;
   #pragma omp parallel for reduction(|:expired)
-  for (int i = 0; i < num_threads; i++) {
+  for (int i = 0; i < num_units; i++) {
     expired |= mdv[i]->IsPairListExpired();
   }
   expired = Communicator::AllReduceBoolean(expired);
   return expired;
 }
 //----------------------------------------------------------------------
+// Called by a single thread after unit_expired has been filled
+//----------------------------------------------------------------------
+bool
+MDManager::IsAnyUnitExpired(void) {
+  bool expired = false;
+  for (int i = 0; i < num_units; i++) {
+    expired |= (unit_expired[i] != 0);
+  }
+  return Communicator::AllReduceBoolean(expired);
+}
+//----------------------------------------------------------------------
+// Temperature() inside the persistent region, with the particle number
+// reduced together with the kinetic energy.
+//----------------------------------------------------------------------
+double
+MDManager::TemperatureInRegion(void) {
+  KineticEnergyObserver obs;
+  #pragma omp for schedule(runtime)
+  for (int k = 0; k < num_units; k++) {
+    const int i = unit_order[k];
+    unit_energy[i] = mdv[i]->ObserveDouble(&obs);
+  }
+  #pragma omp master
+  {
+    double local[2] = {0.0, 0.0};
+    double global[2];
+    for (int i = 0; i < num_units; i++) {
+      local[0] += unit_energy[i];
+      local[1] += static_cast<double>(mdv[i]->GetParticleNumber());
+    }
+    Communicator::AllReduceDoubleBuffer(local, 2, global);
+    region_temperature = global[0] / global[1] / 1.5;
+  }
+  #pragma omp barrier
+  return region_temperature;
+}
+//----------------------------------------------------------------------
 double
 MDManager::ObserveDouble(DoubleObserver *obs) {
   double e = 0.0;
   #pragma omp parallel for reduction(+:e)
-  for (int i = 0; i < num_threads; i++) {
+  for (int i = 0; i < num_units; i++) {
     e += mdv[i]->ObserveDouble(obs);
   }
   return Communicator::AllReduceDouble(e);
@@ -569,6 +1744,37 @@ MDManager::Pressure(void) {
   return (T - phi) * pn / V;
 }
 //----------------------------------------------------------------------
+ThermoSnapshot
+MDManager::TakeThermoSnapshot(void) {
+  std::vector<ThermoSnapshot> unit_snap(num_units);
+  #pragma omp parallel for schedule(runtime)
+  for (int k = 0; k < num_units; k++) {
+    const int i = unit_order[k];
+    mdv[i]->Observe(unit_snap[i]);
+  }
+  ThermoSnapshot snap;
+  for (int i = 0; i < num_units; i++) {
+    snap.Add(unit_snap[i]);
+  }
+  snap.Reduce();
+  snap.SetVolume(sinfo->L[X] * sinfo->L[Y] * sinfo->L[Z]);
+  return snap;
+}
+//----------------------------------------------------------------------
+// Structured record of the observables, after the fields already given
+// to mout. Does nothing without RecordFile.
+//----------------------------------------------------------------------
+void
+MDManager::RecordObservables(const char *tag, ThermoSnapshot &ts) {
+  mout.Field("time", s_time);
+  mout.Field("temperature", ts.Temperature());
+  mout.Field("potential_energy", ts.PotentialEnergy());
+  mout.Field("pressure", ts.Pressure());
+  mout.Field("total_energy", ts.TotalEnergy());
+  mout.Field("particles", ts.GetParticleNumber());
+  mout.EndRecord(tag);
+}
+//----------------------------------------------------------------------
 void
 MDManager::ChangeScale(double alpha) {
   MakePairList();
@@ -576,7 +1782,7 @@ MDManager::ChangeScale(double alpha) {
   sinfo->L[Y] = sinfo->L[Y] * alpha;
   sinfo->L[Z] = sinfo->L[Z] * alpha;
   #pragma omp parallel for schedule(static)
-  for (int i = 0; i < num_threads; i++) {
+  for (int i = 0; i < num_units; i++) {
     mdv[i]->ChangeScale(alpha);
   }
   MakePairList();
@@ -585,12 +1791,52 @@ MDManager::ChangeScale(double alpha) {
 //----------------------------------------------------------------------
 void
 MDManager::ExecuteAll(Executor *ex) {
+  DiscardStepReduction();
+  pairlist_made = false;
+  expiry_ready = false;
   #pragma omp parallel for schedule(static)
-  for (int i = 0; i < num_threads; i++) {
+  for (int i = 0; i < num_units; i++) {
     mdv[i]->Execute(ex);
   }
 }
 //----------------------------------------------------------------------
+// Sort units by the work measured since the last rebuild so that the
+// dynamic schedule starts the heaviest units first.
+//----------------------------------------------------------------------
+void
+MDManager::UpdateUnitOrder(void) {
+  std::vector<double> work(num_units);
+  for (int i = 0; i < num_units; i++) {
+    work[i] = mdv[i]->GetWorkTime() - work_mark[i];
+    work_mark[i] = mdv[i]->GetWorkTime();
+  }
+  std::stable_sort(unit_order.begin(), unit_order.end(),
+                   [&work](int a, int b) {return work[a] > work[b];});
+}
+//----------------------------------------------------------------------
+// Move unit boundaries according to the work measured since the last
+// call, then migrate particles and rebuild the pair lists.
+//----------------------------------------------------------------------
+void
+MDManager::BalanceLoad(void) {
+  std::vector<double> work_local(GetTotalUnits(), 0.0);
+  std::vector<double> work(GetTotalUnits(), 0.0);
+  for (int i = 0; i < num_units; i++) {
+    work_local[mdv[i]->GetID()] = mdv[i]->GetWorkTime() - balance_mark[i];
+    balance_mark[i] = mdv[i]->GetWorkTime();
+  }
+  Communicator::AllReduceDoubleBuffer(work_local.data(), GetTotalUnits(), work.data());
+  if (balancer->Balance(work, pinfo, sinfo)) {
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < num_units; i++) {
+      MDRect r = balancer->GetRect(mdv[i]->GetID(), pinfo, sinfo);
+      mdv[i]->SetRect(r);
+    }
+  }
+  MakePairList();
+  mout << "# " << GetSimulationTime() << " Load imbalance (max/avg) = " << balancer->GetImbalance() << std::endl;
+}
+//----------------------------------------------------------------------
 #ifdef USE_GPU
 void
 MDManager::AdjustCPUGPUWorkBalance(void) {
@@ -599,7 +1845,7 @@ MDManager::AdjustCPUGPUWorkBalance(void) {
 
   if (work_balance <= 0.0) work_balance = 0.0;
   if (work_balance >= 1.0) work_balance = 1.0;
-  for (int i = 0; i < num_threads; i++) {
+  for (int i = 0; i < num_units; i++) {
     mdv[i]->UpdateParticleNumberGPU(work_balance);
   }
 }
@@ -2,8 +2,13 @@
 #include <iostream>
 #include <fstream>
 #include <string.h>
+#include <string>
 #include "mdunit.h"
 #include "fcalculator.h"
+#include "textformat.h"
+#if defined AVX2 || defined AVX512
+#include "simd_avx2.h"
+#endif
 //----------------------------------------------------------------------
 MDUnit::MDUnit(int id_, SimulationInfo *si, ParaInfo *pi):
   id(id_) {
@@ -26,6 +31,11 @@ MDUnit::MDUnit(int id_, SimulationInfo *si, ParaInfo *pi):
     e[d] = s[d] + ul;
   }
   myrect = MDRect(s, e);
+  work_time = 0.0;
+  for (int dir = 0; dir < MAX_DIR; dir++) {
+    ghost_range[dir][0] = 0;
+    ghost_range[dir][1] = 0;
+  }
 
 #ifdef USE_GPU
 #pragma omp critical
@@ -64,21 +74,16 @@ MDUnit::AddParticle(double x[D], double v[D], int type) {
   }
 }
 //----------------------------------------------------------------------
+// Appends the cdview lines of own particles, formatted as the default
+// ostream (%g) by TextFormat.
 void
-MDUnit::SaveAsCdview(std::ofstream &ofs) {
+MDUnit::SaveAsCdview(std::string &buffer) {
   double (*q)[D] = vars->q;
   double (*p)[D] = vars->p;
   int *type = vars->type;
   const int pn = vars->GetParticleNumber();
   for (int i = 0; i < pn; i++) {
-    ofs << "0 ";
-    ofs << type[i] << " ";
-    ofs << q[i][X] << " ";
-    ofs << q[i][Y] << " ";
-    ofs << q[i][Z] << " ";
-    ofs << p[i][X] << " ";
-    ofs << p[i][Y] << " ";
-    ofs << p[i][Z] << "\n";
+    TextFormat::AppendCdviewLine(buffer, type[i], q[i], p[i]);
   }
 }
 //----------------------------------------------------------------------
@@ -91,17 +96,43 @@ MDUnit::SaveConfiguration(void) {
 }
 //----------------------------------------------------------------------
 void
-MDUnit::MakeBufferForSendingParticle(int dir) {
-  send_buffer.clear();
-  int pn = vars->GetParticleNumber();
+MDUnit::MakeBufferForMigration(void) {
+  for (int dir = 0; dir < MAX_DIR; dir++) {
+    migration_buffer[dir].clear();
+  }
+  const int pn = vars->GetParticleNumber();
   double (*q)[D] = vars->q;
   double (*p)[D] = vars->p;
   int *type = vars->type;
   int index = 0;
+#if defined AVX2 || defined AVX512
+  // ASSUME: D == 4
+  const v4df vs = _mm256_loadu_pd(myrect.s);
+  const v4df ve = _mm256_loadu_pd(myrect.e);
   for (int i = 0; i < pn; i++) {
-    if (myrect.IsOverBoundary(dir, q[i])) {
+    const v4df vq = _mm256_loadu_pd(q[i]);
+    const v4df vp = _mm256_loadu_pd(p[i]);
+    const int t = type[i];
+    const int lt = _mm256_movemask_pd(_mm256_cmp_pd(vq, vs, _CMP_LT_OS));
+    const int ge = _mm256_movemask_pd(_mm256_cmp_pd(vq, ve, _CMP_GE_OS));
+    const int mask = (lt & 0x7) | ((ge & 0x7) << 3);
+    _mm256_storeu_pd(q[index], vq);
+    _mm256_storeu_pd(p[index], vp);
+    type[index] = t;
+    if (mask) {
+      const double *a = (const double*)(&vq);
+      const double *b = (const double*)(&vp);
+      ParticleInfo pi(a[X], a[Y], a[Z], b[X], b[Y], b[Z], t);
+      migration_buffer[MDRect::GetMigrationDir(mask)].push_back(pi);
+    }
+    index += (mask == 0);
+  }
+#else
+  for (int i = 0; i < pn; i++) {
+    const int mask = myrect.GetOverBoundaryMask(q[i]);
+    if (mask) {
       ParticleInfo pi(q[i][X], q[i][Y], q[i][Z], p[i][X], p[i][Y], p[i][Z], type[i]);
-      send_buffer.push_back(pi);
+      migration_buffer[MDRect::GetMigrationDir(mask)].push_back(pi);
     } else {
       q[index][X] = q[i][X];
       q[index][Y] = q[i][Y];
@@ -113,18 +144,26 @@ MDUnit::MakeBufferForSendingParticle(int dir) {
       index++;
     }
   }
+#endif
   vars->SetParticleNumber(index);
 }
 //----------------------------------------------------------------------
+// Particles received in the stage dir are kept, or staged again if they
+// are still over a boundary along a later axis.
 void
-MDUnit::ReceiveParticles(std::vector<ParticleInfo> &recv_buffer) {
-  //const unsigned int recv_number = recv_buffer.size() / 6;
+MDUnit::ReceiveMigratingParticles(const int dir, std::vector<ParticleInfo> &recv_buffer) {
+  static const int later_axes[MAX_DIR] = {0x36, 0x36, 0x24, 0x24, 0x00, 0x00};
   const unsigned int recv_number = recv_buffer.size();
   int index = vars->GetParticleNumber();
   double (*q)[D] = vars->q;
   double (*p)[D] = vars->p;
   int *type = vars->type;
   for (unsigned int i = 0; i < recv_number; i++) {
+    const int mask = myrect.GetOverBoundaryMask(recv_buffer[i].q) & later_axes[dir];
+    if (mask) {
+      migration_buffer[MDRect::GetMigrationDir(mask)].push_back(recv_buffer[i]);
+      continue;
+    }
     q[index][X] = recv_buffer[i].q[X];
     q[index][Y] = recv_buffer[i].q[Y];
     q[index][Z] = recv_buffer[i].q[Z];
@@ -137,12 +176,15 @@ MDUnit::ReceiveParticles(std::vector<ParticleInfo> &recv_buffer) {
   vars->SetParticleNumber(index);
 }
 //----------------------------------------------------------------------
+// Own particles come from the cell-based candidates; only the ghosts
+// received in the previous stages are scanned.
 void
 MDUnit::FindBorderParticles(const int dir) {
-  border_particles[dir].clear();
-  const int pn  = vars->GetTotalParticleNumber();
+  border_particles[dir] = border_candidates[dir];
+  const int pn = vars->GetParticleNumber();
+  const int tn = vars->GetTotalParticleNumber();
   double (*q)[D] = vars->q;
-  for (int i = 0; i < pn; i++) {
+  for (int i = pn; i < tn; i++) {
     if (myrect.IsInsideEdge(dir, q[i], sinfo)) {
       border_particles[dir].push_back(i);
     }
@@ -192,26 +234,97 @@ MDUnit::MakeBufferForBorderParticles(const int dir) {
 }
 //----------------------------------------------------------------------
 void
-MDUnit::ReceiveBorderParticles(std::vector<ParticleInfo> &recv_buffer) {
+MDUnit::ReceiveBorderParticles(const int dir, std::vector<ParticleInfo> &recv_buffer) {
   //const unsigned int recv_number = recv_buffer.size() / D;
   const unsigned int recv_number = recv_buffer.size();
   int index = vars->GetTotalParticleNumber();
   double (*q)[D] = vars->q;
+  double (*p)[D] = vars->p;
   //memcpy(q[index], &recv_buffer[0], sizeof(double)*recv_number * D);
   for(int i=0;i<recv_number;i++){
     q[i+index][X] = recv_buffer[i].q[X];
     q[i+index][Y] = recv_buffer[i].q[Y];
     q[i+index][Z] = recv_buffer[i].q[Z];
   }
+  // Ghost momenta accumulate the reaction forces in half-shell mode
+  if (sinfo->HalfShell) {
+    for (unsigned int i = 0; i < recv_number; i++) {
+      p[i + index][X] = 0.0;
+      p[i + index][Y] = 0.0;
+      p[i + index][Z] = 0.0;
+    }
+  }
+  ghost_range[dir][0] = index;
   index = index + recv_number;
+  ghost_range[dir][1] = index;
   vars->SetTotalParticleNumber(index);
 }
 //----------------------------------------------------------------------
 void
+MDUnit::MakeBufferForBorderMomenta(const int dir) {
+  momentum_buffer.clear();
+  double (*p)[D] = vars->p;
+  for (int i = ghost_range[dir][0]; i < ghost_range[dir][1]; i++) {
+    momentum_buffer.push_back(p[i][X]);
+    momentum_buffer.push_back(p[i][Y]);
+    momentum_buffer.push_back(p[i][Z]);
+  }
+}
+//----------------------------------------------------------------------
+void
+MDUnit::ReceiveBorderMomenta(const int dir, const double *recv_buffer) {
+  double (*p)[D] = vars->p;
+  for (unsigned int k = 0; k < border_particles[dir].size(); k++) {
+    const int i = border_particles[dir][k];
+    p[i][X] += recv_buffer[k * 3 + X];
+    p[i][Y] += recv_buffer[k * 3 + Y];
+    p[i][Z] += recv_buffer[k * 3 + Z];
+  }
+}
+//----------------------------------------------------------------------
+void
 MDUnit::MakePairList(void) {
+  const double t = omp_get_wtime();
   mesh->Sort(vars, sinfo, myrect);
   plist->Init(vars, sinfo);
+  mesh->SetGhostRange(ghost_range);
   mesh->MakeList(vars, sinfo, myrect);
+  work_time += omp_get_wtime() - t;
+}
+//----------------------------------------------------------------------
+// OverlapInteriorPairs: particles are sorted and the border candidates are
+// found before the ghosts arrive, then own pairs are searched while the
+// ghosts are exchanged, and the pairs with ghosts are added afterwards.
+void
+MDUnit::PrepareInteriorPairList(void) {
+  const double t = omp_get_wtime();
+  mesh->Sort(vars, sinfo, myrect);
+  vars->SetTotalParticleNumber(vars->GetParticleNumber());
+  mesh->FindBorderCandidates(vars, sinfo, myrect, border_candidates);
+  work_time += omp_get_wtime() - t;
+}
+//----------------------------------------------------------------------
+void
+MDUnit::MakeInteriorPairList(void) {
+  const double t = omp_get_wtime();
+  mesh->MakeInteriorList(vars, sinfo);
+  work_time += omp_get_wtime() - t;
+}
+//----------------------------------------------------------------------
+void
+MDUnit::MakeBorderPairList(void) {
+  const double t = omp_get_wtime();
+  plist->Init(vars, sinfo);
+  mesh->SetGhostRange(ghost_range);
+  mesh->MakeBorderList(vars, sinfo, myrect);
+  work_time += omp_get_wtime() - t;
+}
+//----------------------------------------------------------------------
+// Particles outside the new rect are migrated by the next MakePairList
+void
+MDUnit::SetRect(MDRect &r) {
+  myrect = r;
+  mesh->ChangeScale(sinfo, myrect);
 }
 //----------------------------------------------------------------------
 void
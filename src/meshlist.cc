@@ -12,6 +12,13 @@
 MeshList::MeshList(SimulationInfo *sinfo, MDRect &r) {
   number_of_constructions = 0;
   sort_interval = 10;
+  half_shell = sinfo->HalfShell;
+  sparse = sinfo->SparseMesh;
+  border_only = false;
+  for (int dir = 0; dir < MAX_DIR; dir++) {
+    ghost_range[dir][0] = 0;
+    ghost_range[dir][1] = 0;
+  }
 
   mesh_index = NULL;
   mesh_index2 = NULL;
@@ -58,6 +65,12 @@ MeshList::ChangeScale(SimulationInfo *sinfo, MDRect &myrect) {
   mz = static_cast <int> (wz / mesh_size_z) + 2;
 
   number_of_mesh = mx * my * mz;
+  if (sparse) {
+    mesh_index = NULL;
+    mesh_index2 = NULL;
+    mesh_particle_number = NULL;
+    return;
+  }
   mesh_index = new int[number_of_mesh];
   mesh_index2 = new int[number_of_mesh];
   mesh_particle_number = new int[number_of_mesh];
@@ -65,6 +78,14 @@ MeshList::ChangeScale(SimulationInfo *sinfo, MDRect &myrect) {
 }
 //----------------------------------------------------------------------
 void
+MeshList::SetGhostRange(int range[MAX_DIR][2]) {
+  for (int dir = 0; dir < MAX_DIR; dir++) {
+    ghost_range[dir][0] = range[dir][0];
+    ghost_range[dir][1] = range[dir][1];
+  }
+}
+//----------------------------------------------------------------------
+void
 MeshList::MakeList(Variables *vars, SimulationInfo *sinfo, MDRect &myrect) {
   number_of_pairs = 0;
   const int pn = vars->GetTotalParticleNumber();
@@ -73,7 +94,40 @@ MeshList::MakeList(Variables *vars, SimulationInfo *sinfo, MDRect &myrect) {
   }
   MakeListMesh(vars, sinfo, myrect);
   //MakeListBruteforce(vars,sinfo,myrect);
-
+  MakeSortedList(pn);
+}
+//----------------------------------------------------------------------
+// Pairs of own particles, searched on the mesh left by
+// FindBorderCandidates. Reads only own particles, so that the ghosts
+// can be received concurrently.
+//----------------------------------------------------------------------
+void
+MeshList::MakeInteriorList(Variables *vars, SimulationInfo *sinfo) {
+  number_of_pairs = 0;
+  const int pn = vars->GetParticleNumber();
+  for (int i = 0; i < pn; i++) {
+    number_of_partners[i] = 0;
+  }
+  SearchAllMesh(vars, sinfo);
+}
+//----------------------------------------------------------------------
+// Pairs involving ghosts, appended to the pairs of MakeInteriorList
+//----------------------------------------------------------------------
+void
+MeshList::MakeBorderList(Variables *vars, SimulationInfo *sinfo, MDRect &myrect) {
+  const int pn = vars->GetParticleNumber();
+  const int tn = vars->GetTotalParticleNumber();
+  for (int i = pn; i < tn; i++) {
+    number_of_partners[i] = 0;
+  }
+  border_only = true;
+  MakeListMesh(vars, sinfo, myrect);
+  border_only = false;
+  MakeSortedList(tn);
+}
+//----------------------------------------------------------------------
+void
+MeshList::MakeSortedList(const int pn) {
   const int s = number_of_pairs;
 #if defined AVX2 || defined AVX512
   for (int k = 0; k < s; k++) {
@@ -125,7 +179,14 @@ MeshList::MakeListBruteforce(Variables *vars, SimulationInfo *sinfo, MDRect &myr
 void
 MeshList::MakeListMesh(Variables *vars, SimulationInfo *sinfo, MDRect &myrect) {
   MakeMesh(vars, sinfo, myrect);
-  for (int i = 0; i < number_of_mesh; i++) {
+  SearchAllMesh(vars, sinfo);
+}
+//----------------------------------------------------------------------
+void
+MeshList::SearchAllMesh(Variables *vars, SimulationInfo *sinfo) {
+  const int nm = sparse ? cell_key.size() : number_of_mesh;
+  for (int k = 0; k < nm; k++) {
+    const int i = sparse ? cell_key[k] : k;
 #ifdef AVX2
     SearchMeshAVX2(i, vars, sinfo);
 #elif AVX512
@@ -172,6 +233,67 @@ MeshList::Sort(Variables *vars, SimulationInfo *sinfo, MDRect &myrect) {
   mout << "# Sorted!" << std::endl;
 }
 //----------------------------------------------------------------------
+// Own particles within SearchLength of each face, taken from the cell
+// layers next to the face. Must be called while only own particles are
+// registered (total particle number == particle number).
+//----------------------------------------------------------------------
+void
+MeshList::FindBorderCandidates(Variables *vars, SimulationInfo *sinfo, MDRect &myrect,
+                               std::vector<int> candidates[MAX_DIR]) {
+  MakeMesh(vars, sinfo, myrect);
+  double (*q)[D] = vars->q;
+  const double SL = sinfo->SearchLength;
+  // Layers include the outer cell, which may hold particles by rounding
+  const int lx = std::min(static_cast<int>(ceil(SL / mesh_size_x)) + 1, mx - 1);
+  const int ly = std::min(static_cast<int>(ceil(SL / mesh_size_y)) + 1, my - 1);
+  const int lz = std::min(static_cast<int>(ceil(SL / mesh_size_z)) + 1, mz - 1);
+  const int range[MAX_DIR][3][2] = {
+    {{0, lx}, {0, my - 1}, {0, mz - 1}},
+    {{mx - 1 - lx, mx - 1}, {0, my - 1}, {0, mz - 1}},
+    {{0, mx - 1}, {0, ly}, {0, mz - 1}},
+    {{0, mx - 1}, {my - 1 - ly, my - 1}, {0, mz - 1}},
+    {{0, mx - 1}, {0, my - 1}, {0, lz}},
+    {{0, mx - 1}, {0, my - 1}, {mz - 1 - lz, mz - 1}},
+  };
+  for (int dir = 0; dir < MAX_DIR; dir++) {
+    std::vector<int> &v = candidates[dir];
+    v.clear();
+    if (sparse) {
+      for (unsigned int c = 0; c < cell_key.size(); c++) {
+        int ix, iy, iz;
+        index2pos(cell_key[c], ix, iy, iz);
+        if (ix < range[dir][X][0] || ix > range[dir][X][1]) continue;
+        if (iy < range[dir][Y][0] || iy > range[dir][Y][1]) continue;
+        if (iz < range[dir][Z][0] || iz > range[dir][Z][1]) continue;
+        for (int k = cell_start[c]; k < cell_start[c] + cell_number[c]; k++) {
+          const int i = sortbuf[k];
+          if (myrect.IsInsideEdge(dir, q[i], sinfo)) {
+            v.push_back(i);
+          }
+        }
+      }
+    } else {
+      for (int iz = range[dir][Z][0]; iz <= range[dir][Z][1]; iz++) {
+        for (int iy = range[dir][Y][0]; iy <= range[dir][Y][1]; iy++) {
+          for (int ix = range[dir][X][0]; ix <= range[dir][X][1]; ix++) {
+            const int index = pos2index(ix, iy, iz);
+            const int mi = mesh_index[index];
+            const int in = mesh_particle_number[index];
+            for (int k = mi; k < mi + in; k++) {
+              const int i = sortbuf[k];
+              if (myrect.IsInsideEdge(dir, q[i], sinfo)) {
+                v.push_back(i);
+              }
+            }
+          }
+        }
+      }
+    }
+    // Keep the index order of a linear scan
+    std::sort(v.begin(), v.end());
+  }
+}
+//----------------------------------------------------------------------
 void
 MeshList::MakeMesh(Variables *vars, SimulationInfo *sinfo, MDRect &myrect) {
 
@@ -183,8 +305,10 @@ MeshList::MakeMesh(Variables *vars, SimulationInfo *sinfo, MDRect &myrect) {
   double imz = 1.0 / mesh_size_z;
   double *s = myrect.GetStartPosition();
 
-  for (int i = 0; i < number_of_mesh; i++) {
-    mesh_particle_number[i] = 0;
+  if (!sparse) {
+    for (int i = 0; i < number_of_mesh; i++) {
+      mesh_particle_number[i] = 0;
+    }
   }
   for (int i = 0; i < pn; i++) {
     int ix = static_cast<int>((q[i][X] - s[X]) * imx) + 1;
@@ -206,9 +330,13 @@ MeshList::MakeMesh(Variables *vars, SimulationInfo *sinfo, MDRect &myrect) {
       exit(1);
     }
     particle_position[i] = index;
-    mesh_particle_number[index]++;
+    if (!sparse) mesh_particle_number[index]++;
 
   }
+  if (sparse) {
+    MakeSparseMesh(pn);
+    return;
+  }
   mesh_index[0] = 0;
   int sum = 0;
   for (int i = 0; i < number_of_mesh - 1; i++) {
@@ -227,15 +355,55 @@ MeshList::MakeMesh(Variables *vars, SimulationInfo *sinfo, MDRect &myrect) {
   }
 }
 //----------------------------------------------------------------------
+// Sparse mesh: the particles are sorted by cell index, and only the
+// occupied cells are stored, so that the memory and the search scale with
+// the number of particles rather than the volume of the unit.
+//----------------------------------------------------------------------
+void
+MeshList::MakeSparseMesh(const int pn) {
+  cell_sort.resize(pn);
+  for (int i = 0; i < pn; i++) {
+    cell_sort[i] = std::make_pair(particle_position[i], i);
+  }
+  std::sort(cell_sort.begin(), cell_sort.end());
+  cell_key.clear();
+  cell_start.clear();
+  cell_number.clear();
+  for (int j = 0; j < pn; j++) {
+    const int index = cell_sort[j].first;
+    sortbuf[j] = cell_sort[j].second;
+    if (cell_key.empty() || cell_key.back() != index) {
+      cell_key.push_back(index);
+      cell_start.push_back(j);
+      cell_number.push_back(0);
+    }
+    cell_number.back()++;
+  }
+}
+//----------------------------------------------------------------------
+inline bool
+MeshList::FindCell(int index, int &mi, int &in) {
+  if (!sparse) {
+    mi = mesh_index[index];
+    in = mesh_particle_number[index];
+    return in > 0;
+  }
+  std::vector<int>::iterator it = std::lower_bound(cell_key.begin(), cell_key.end(), index);
+  if (it == cell_key.end() || *it != index) return false;
+  const int c = it - cell_key.begin();
+  mi = cell_start[c];
+  in = cell_number[c];
+  return true;
+}
+//----------------------------------------------------------------------
 void
 MeshList::AppendList(int ix, int iy, int iz, std::vector<int> &v) {
   if (ix < 0 || ix >= mx)return;
   if (iy < 0 || iy >= my)return;
   if (iz < 0 || iz >= mz)return;
 
-  const int index = pos2index(ix, iy, iz);
-  const int in = mesh_particle_number[index];
-  const int mi = mesh_index[index];
+  int mi, in;
+  if (!FindCell(pos2index(ix, iy, iz), mi, in)) return;
   v.insert(v.end(), &sortbuf[mi], &sortbuf[mi + in]);
 }
 //----------------------------------------------------------------------
@@ -252,6 +420,7 @@ MeshList::SearchMesh(int index, Variables *vars, SimulationInfo *sinfo) {
   v.clear();
 
   AppendList(ix, iy, iz, v);
+  const int in = v.size();
   AppendList(ix + 1,  iy, iz, v);
   AppendList(ix - 1,  iy + 1, iz, v);
   AppendList(ix,  iy + 1, iz, v);
@@ -271,7 +440,6 @@ MeshList::SearchMesh(int index, Variables *vars, SimulationInfo *sinfo) {
   const int pn = vars->GetParticleNumber();
   double (*q)[D] = vars->q;
 
-  const int in = mesh_particle_number[index];
   const int ln = v.size();
   for (int i = 0; i < in; i++) {
     const int i1 = v[i];
@@ -280,7 +448,7 @@ MeshList::SearchMesh(int index, Variables *vars, SimulationInfo *sinfo) {
     const double z1 = q[i1][Z];
     for (int j = i + 1; j < ln; j++) {
       const int i2 = v[j];
-      if (i1 >= pn && i2 >= pn)continue;
+      if (!IsSearchPair(i1, i2, pn))continue;
       const double dx = x1 - q[i2][X];
       const double dy = y1 - q[i2][Y];
       const double dz = z1 - q[i2][Z];
@@ -302,6 +470,7 @@ MeshList::SearchMeshAVX2(int index, Variables *vars, SimulationInfo *sinfo) {
   v.clear();
 
   AppendList(ix, iy, iz, v);
+  const int in = v.size();
   AppendList(ix + 1,  iy, iz, v);
   AppendList(ix - 1,  iy + 1, iz, v);
   AppendList(ix,  iy + 1, iz, v);
@@ -321,7 +490,6 @@ MeshList::SearchMeshAVX2(int index, Variables *vars, SimulationInfo *sinfo) {
   const int pn = vars->GetParticleNumber();
   double (*q)[D] = vars->q;
 
-  const int in = mesh_particle_number[index];
   const int ln = v.size();
 
   const auto vpn = _mm256_set1_epi64x(pn);
@@ -343,9 +511,15 @@ MeshList::SearchMeshAVX2(int index, Variables *vars, SimulationInfo *sinfo) {
     transpose_4x4(vqia, vqib, vqic, vqid, vqix, vqiy, vqiz);
 
     const int i_less_than_pn = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(vpn, vi_id)));
+    int i_pairing = i_less_than_pn;
+    if (IsPairingGhost(i_a)) i_pairing |= 0x1;
+    if (IsPairingGhost(i_b)) i_pairing |= 0x2;
+    if (IsPairingGhost(i_c)) i_pairing |= 0x4;
+    if (IsPairingGhost(i_d)) i_pairing |= 0x8;
+    const int i_own_pairing = border_only ? (i_pairing & ~i_less_than_pn) : i_pairing;
     for (int k = i + 4; k < ln; k++) {
       const auto j = v[k];
-      const int j_less_than_pn = (j < pn) ? 0xf : 0;
+      const int pair_mask = (j < pn) ? i_own_pairing : (IsPairingGhost(j) ? i_less_than_pn : 0);
 
       auto vqjx = _mm256_set1_pd(q[j][X]);
       auto vqjy = _mm256_set1_pd(q[j][Y]);
@@ -362,7 +536,7 @@ MeshList::SearchMeshAVX2(int index, Variables *vars, SimulationInfo *sinfo) {
       auto dvr2_flag = _mm256_cmp_pd(dvr2, vsl2, _CMP_LE_OS);
       int le_sl2 = _mm256_movemask_pd(dvr2_flag);
 
-      const int shfl_key = (i_less_than_pn | j_less_than_pn) & le_sl2;
+      const int shfl_key = pair_mask & le_sl2;
       if (shfl_key == 0) continue;
 
       const int incr = _popcnt32(shfl_key);
@@ -387,12 +561,12 @@ MeshList::SearchMeshAVX2(int index, Variables *vars, SimulationInfo *sinfo) {
     }
 
     // remaining pairs
-    if (i_a < pn || i_b < pn) RegisterInteractPair(q, i_a, i_b, S2);
-    if (i_a < pn || i_c < pn) RegisterInteractPair(q, i_a, i_c, S2);
-    if (i_a < pn || i_d < pn) RegisterInteractPair(q, i_a, i_d, S2);
-    if (i_b < pn || i_c < pn) RegisterInteractPair(q, i_b, i_c, S2);
-    if (i_b < pn || i_d < pn) RegisterInteractPair(q, i_b, i_d, S2);
-    if (i_c < pn || i_d < pn) RegisterInteractPair(q, i_c, i_d, S2);
+    if (IsSearchPair(i_a, i_b, pn)) RegisterInteractPair(q, i_a, i_b, S2);
+    if (IsSearchPair(i_a, i_c, pn)) RegisterInteractPair(q, i_a, i_c, S2);
+    if (IsSearchPair(i_a, i_d, pn)) RegisterInteractPair(q, i_a, i_d, S2);
+    if (IsSearchPair(i_b, i_c, pn)) RegisterInteractPair(q, i_b, i_c, S2);
+    if (IsSearchPair(i_b, i_d, pn)) RegisterInteractPair(q, i_b, i_d, S2);
+    if (IsSearchPair(i_c, i_d, pn)) RegisterInteractPair(q, i_c, i_d, S2);
   }
 
   // remaining i loop
@@ -403,7 +577,7 @@ MeshList::SearchMeshAVX2(int index, Variables *vars, SimulationInfo *sinfo) {
     const double z1 = q[i1][Z];
     for (int j = i + 1; j < ln; j++) {
       const int i2 = v[j];
-      if (i1 >= pn && i2 >= pn)continue;
+      if (!IsSearchPair(i1, i2, pn))continue;
       const double dx = x1 - q[i2][X];
       const double dy = y1 - q[i2][Y];
       const double dz = z1 - q[i2][Z];
@@ -426,6 +600,7 @@ MeshList::SearchMeshAVX512(int index, Variables *vars, SimulationInfo *sinfo) {
   v.clear();
 
   AppendList(ix, iy, iz, v);
+  const int in = v.size();
   AppendList(ix + 1,  iy, iz, v);
   AppendList(ix - 1,  iy + 1, iz, v);
   AppendList(ix,  iy + 1, iz, v);
@@ -445,7 +620,6 @@ MeshList::SearchMeshAVX512(int index, Variables *vars, SimulationInfo *sinfo) {
   const int pn = vars->GetParticleNumber();
   double (*q)[D] = vars->q;
 
-  const int in = mesh_particle_number[index];
   const int ln = v.size();
 
   const auto vpn = _mm512_set1_epi64(pn);
@@ -465,9 +639,14 @@ MeshList::SearchMeshAVX512(int index, Variables *vars, SimulationInfo *sinfo) {
     auto vqiz   = _mm512_i64gather_pd(vindex, &q[0][Z], 8);
 
     const auto i_less_than_pn = _mm512_cmpgt_epi64_mask(vpn, vi_id);
+    __mmask8 i_pairing = i_less_than_pn;
+    for (int l = 0; l < 8; l++) {
+      if (IsPairingGhost(v[i + l])) i_pairing |= (1 << l);
+    }
+    const __mmask8 i_own_pairing = border_only ? (i_pairing & ~i_less_than_pn) : i_pairing;
     for (int k = i + 8; k < ln; k++) {
       const auto j = v[k];
-      const __mmask8 j_less_than_pn = (j < pn) ? 0xff : 0;
+      const __mmask8 pair_mask = (j < pn) ? i_own_pairing : (IsPairingGhost(j) ? i_less_than_pn : 0);
 
       auto vqjx = _mm512_set1_pd(q[j][X]);
       auto vqjy = _mm512_set1_pd(q[j][Y]);
@@ -483,8 +662,7 @@ MeshList::SearchMeshAVX512(int index, Variables *vars, SimulationInfo *sinfo) {
 
       auto le_sl2 = _mm512_cmp_pd_mask(dvr2, vsl2, _CMP_LE_OS);
 
-      const auto shfl_key = _mm512_kand(_mm512_kor(i_less_than_pn, j_less_than_pn),
-                                        le_sl2);
+      const auto shfl_key = _mm512_kand(pair_mask, le_sl2);
       if (shfl_key == 0) continue;
 
       const auto incr = _popcnt32(shfl_key);
@@ -513,7 +691,7 @@ MeshList::SearchMeshAVX512(int index, Variables *vars, SimulationInfo *sinfo) {
       for (int l = k + 1; l < 8; l++) {
         const auto i_k = v[i + k];
         const auto i_l = v[i + l];
-        if (i_k < pn || i_l < pn) RegisterInteractPair(q, i_k, i_l, S2);
+        if (IsSearchPair(i_k, i_l, pn)) RegisterInteractPair(q, i_k, i_l, S2);
       }
     }
   }
@@ -526,7 +704,7 @@ MeshList::SearchMeshAVX512(int index, Variables *vars, SimulationInfo *sinfo) {
     const double z1 = q[i1][Z];
     for (int j = i + 1; j < ln; j++) {
       const int i2 = v[j];
-      if (i1 >= pn && i2 >= pn)continue;
+      if (!IsSearchPair(i1, i2, pn))continue;
       const double dx = x1 - q[i2][X];
       const double dy = y1 - q[i2][Y];
       const double dz = z1 - q[i2][Z];
@@ -552,6 +730,24 @@ MeshList::pos2index(int ix, int iy, int iz) {
   return mx * my * iz + mx * iy + ix;
 }
 //----------------------------------------------------------------------
+// In half-shell mode, an own particle is paired only with the ghosts
+// received from the upper neighbours (+x, +y, +z), so that each pair
+// across the unit boundary is registered by exactly one unit.
+inline bool
+MeshList::IsPairingGhost(int i) {
+  if (!half_shell) return true;
+  return (i >= ghost_range[D_LEFT][0] && i < ghost_range[D_LEFT][1]) ||
+         (i >= ghost_range[D_BACK][0] && i < ghost_range[D_BACK][1]) ||
+         (i >= ghost_range[D_DOWN][0] && i < ghost_range[D_DOWN][1]);
+}
+//----------------------------------------------------------------------
+inline bool
+MeshList::IsSearchPair(int i1, int i2, int pn) {
+  if (i1 < pn && i2 < pn) return !border_only;
+  if (i1 >= pn && i2 >= pn) return false;
+  return IsPairingGhost(i1 < pn ? i2 : i1);
+}
+//----------------------------------------------------------------------
 inline void
 MeshList::RegisterPair(int index1, int index2) {
   int i1, i2;
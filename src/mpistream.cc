@@ -1,37 +1,100 @@
-#include <fstream>
+#include <cmath>
 #include <omp.h>
 #include "mpistream.h"
 
 MPIStream mout;
 //----------------------------------------------------------------------
 MPIStream & MPIStream::operator << (std::ostream & (*pf)(std::ostream &)) {
-  os_backup << pf;
 //#pragma omp parallel
   if (0 == rank && omp_get_thread_num() == 0) {
     std::cout << oss.str() << pf;
+    if (log.is_open()) {
+      log << oss.str() << pf;
+      FlushIfDue();
+    }
   }
   oss.str("");
   oss.clear();
   return *this;
 };
 //----------------------------------------------------------------------
+bool
+MPIStream::OpenLog(const std::string &filename, bool append) {
+  if (0 != rank) return true;
+  if (log.is_open()) log.close();
+  log.open(filename.c_str(), append ? std::ios_base::app : std::ios_base::trunc);
+  return log.is_open();
+}
+//----------------------------------------------------------------------
+bool
+MPIStream::OpenRecords(const std::string &filename, int format) {
+  if (0 != rank) return true;
+  if (records.is_open()) records.close();
+  records.open(filename.c_str());
+  record_format = format;
+  record_header.clear();
+  return records.is_open();
+}
+//----------------------------------------------------------------------
+void
+MPIStream::Flush(void) {
+  if (log.is_open()) log.flush();
+  if (records.is_open()) records.flush();
+  last_flush = omp_get_wtime();
+}
+//----------------------------------------------------------------------
 void
-MPIStream::SaveToFile(std::string filename) {
-  if (0 != rank || omp_get_thread_num() != 0) {
-    return;
+MPIStream::FlushIfDue(void) {
+  if (omp_get_wtime() - last_flush >= flush_interval) {
+    Flush();
   }
-  std::ofstream ofs(filename.c_str());
-  ofs << os_backup.str() << std::endl;
 }
 //----------------------------------------------------------------------
+MPIStream &
+MPIStream::Field(const char *key, double value) {
+  if (0 == rank && records.is_open()) {
+    keys.push_back(key);
+    values.push_back(value);
+  }
+  return *this;
+}
+//----------------------------------------------------------------------
+// A CSV header is written whenever the columns change. In JSON, values
+// which are not finite are written as null.
+//----------------------------------------------------------------------
 void
-MPIStream::AppendToFile(std::string filename) {
-  if (0 != rank || omp_get_thread_num() != 0) {
-    return;
+MPIStream::EndRecord(const char *tag) {
+  if (0 != rank || !records.is_open()) return;
+  std::ostringstream line;
+  line.precision(10);
+  if (CSV == record_format) {
+    std::string header = "tag";
+    for (unsigned int i = 0; i < keys.size(); i++) {
+      header += "," + keys[i];
+    }
+    if (header != record_header) {
+      records << header << "\n";
+      record_header = header;
+    }
+    line << tag;
+    for (unsigned int i = 0; i < values.size(); i++) {
+      line << "," << values[i];
+    }
+  } else {
+    line << "{\"tag\":\"" << tag << "\"";
+    for (unsigned int i = 0; i < keys.size(); i++) {
+      line << ",\"" << keys[i] << "\":";
+      if (std::isfinite(values[i])) {
+        line << values[i];
+      } else {
+        line << "null";
+      }
+    }
+    line << "}";
   }
-  std::ofstream ofs(filename.c_str(), std::ios_base::app);
-  ofs << os_backup.str() << std::endl;
+  records << line.str() << "\n";
+  keys.clear();
+  values.clear();
+  FlushIfDue();
 }
 //----------------------------------------------------------------------
-
-
@@ -36,7 +36,7 @@ PotentialEnergyObserver::Observe(Variables *vars, MeshList *mesh) {
     const double r2 = (dx * dx + dy * dy + dz * dz);
     if (r2 > CL2) continue;
     double e = 4.0 * (1.0 / (r2 * r2 * r2 * r2 * r2 * r2) - 1.0 / (r2 * r2 * r2) + C2 * r2 + C0);
-    if (i >= pn || j >= pn ) {
+    if ((i >= pn || j >= pn) && !mesh->IsHalfShell()) {
       e *= 0.5;
     }
     energy += e;
@@ -67,7 +67,7 @@ VirialObserver::Observe(Variables *vars, MeshList *mesh) {
     if (r2 > CL2) continue;
     const double r6 = r2 * r2 * r2;
     double df = ((24.0 * r6 - 48.0) / (r6 * r6 * r2) + C_2 * 8.0) * r2;
-    if ( i >= pn || j >= pn) {
+    if ((i >= pn || j >= pn) && !mesh->IsHalfShell()) {
       df *= 0.5;
     }
     phi += df;
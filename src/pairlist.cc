@@ -3,9 +3,14 @@
 //----------------------------------------------------------------------
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <math.h>
 #include "mpistream.h"
 #include "communicator.h"
 #include "pairlist.h"
+#if defined AVX2 || defined AVX512
+#include "simd_avx2.h"
+#endif
 //----------------------------------------------------------------------
 void
 PairList::Init(Variables *vars, SimulationInfo *sinfo) {
@@ -46,17 +51,43 @@ PairList::IsPairListExpired(Variables *vars, MeshList *mesh, SimulationInfo *sin
 //----------------------------------------------------------------------
 void
 PairList::UpdatePairListValidity(const int pn, double p[N][D], SimulationInfo *sinfo) {
-  double max_velocity = p[0][X] * p[0][X] + p[0][Y] * p[0][Y] + p[0][Z] * p[0][Z];
-  int index = 0;
-  for (int i = 1; i < pn; i++) {
+  double max_velocity = 0.0;
+#if defined AVX2 || defined AVX512
+  // ASSUME: D == 4
+  v4df vmax = _mm256_setzero_pd();
+  int i = 0;
+  for (; i + 3 < pn; i += 4) {
+    v4df vpx, vpy, vpz;
+    transpose_4x4(_mm256_loadu_pd(p[i]), _mm256_loadu_pd(p[i + 1]),
+                  _mm256_loadu_pd(p[i + 2]), _mm256_loadu_pd(p[i + 3]),
+                  vpx, vpy, vpz);
+    vmax = _mm256_max_pd(vmax, vpx * vpx + vpy * vpy + vpz * vpz);
+  }
+  const double *m = (const double*)(&vmax);
+  max_velocity = std::max(std::max(m[0], m[1]), std::max(m[2], m[3]));
+  for (; i < pn; i++) {
+    max_velocity = std::max(max_velocity, p[i][X] * p[i][X] + p[i][Y] * p[i][Y] + p[i][Z] * p[i][Z]);
+  }
+#else
+  for (int i = 0; i < pn; i++) {
     double v = p[i][X] * p[i][X] + p[i][Y] * p[i][Y] + p[i][Z] * p[i][Z];
     if (v > max_velocity) {
       max_velocity = v;
-      index = i;
     }
   }
+#endif
   max_velocity = sqrt(max_velocity);
   if (max_velocity * 2.0 * sinfo->TimeStep > sinfo->BufferLength) {
+    // The offending particle is only looked up on the error path
+    int index = 0;
+    double v_max = 0.0;
+    for (int i = 0; i < pn; i++) {
+      double v = p[i][X] * p[i][X] + p[i][Y] * p[i][Y] + p[i][Z] * p[i][Z];
+      if (v > v_max) {
+        v_max = v;
+        index = i;
+      }
+    }
     show_error("Too fast particles exists. Try smaller time step");
     printf("%d :max_velocity = %f\n", index, max_velocity);
     exit(1);
@@ -64,13 +95,28 @@ PairList::UpdatePairListValidity(const int pn, double p[N][D], SimulationInfo *s
   buffer_length = buffer_length - max_velocity * 2.0 * sinfo->TimeStep;
 }
 //----------------------------------------------------------------------
-bool
-PairList::CheckByDisplacement(Variables *vars, MeshList *mesh, SimulationInfo *sinfo) {
-  const int pn = vars->GetTotalParticleNumber();
-  double (*q)[D] = vars->q;
-
+double
+PairList::CalculateDisplacement(const int pn, double q[N][D]) {
   double dr2_max = 0.0;
-  for (int i = 0; i < pn; i++) {
+  int i = 0;
+#if defined AVX2 || defined AVX512
+  // ASSUME: D == 4
+  v4df vmax = _mm256_setzero_pd();
+  for (; i + 3 < pn; i += 4) {
+    v4df vdx, vdy, vdz;
+    transpose_4x4(_mm256_loadu_pd(qb_old[i]) - _mm256_loadu_pd(q[i]),
+                  _mm256_loadu_pd(qb_old[i + 1]) - _mm256_loadu_pd(q[i + 1]),
+                  _mm256_loadu_pd(qb_old[i + 2]) - _mm256_loadu_pd(q[i + 2]),
+                  _mm256_loadu_pd(qb_old[i + 3]) - _mm256_loadu_pd(q[i + 3]),
+                  vdx, vdy, vdz);
+    const v4df vdr2 = vdx * vdx + vdy * vdy + vdz * vdz;
+    _mm256_storeu_pd(disp + i, vdr2);
+    vmax = _mm256_max_pd(vmax, vdr2);
+  }
+  const double *m = (const double*)(&vmax);
+  dr2_max = std::max(std::max(m[0], m[1]), std::max(m[2], m[3]));
+#endif
+  for (; i < pn; i++) {
     double dx = qb_old[i][X] - q[i][X];
     double dy = qb_old[i][Y] - q[i][Y];
     double dz = qb_old[i][Z] - q[i][Z];
@@ -80,41 +126,78 @@ PairList::CheckByDisplacement(Variables *vars, MeshList *mesh, SimulationInfo *s
       dr2_max = dr2;
     }
   }
+  return dr2_max;
+}
+//----------------------------------------------------------------------
+bool
+PairList::CheckByDisplacement(Variables *vars, MeshList *, SimulationInfo *sinfo) {
+  const int pn = vars->GetTotalParticleNumber();
+  double (*q)[D] = vars->q;
 
+  const double dr2_max = CalculateDisplacement(pn, q);
 
   const int Nl = (pn > sinfo->CheckListLength) ? sinfo->CheckListLength : pn;
-  std::vector<int> v;
+  candidates.clear();
 
   const double c_distance = sinfo->BufferLength - sqrt(dr2_max);
   const double c_d2 = c_distance * c_distance;
   for (int i = 0; i < pn; i++) {
     if (disp[i] > c_d2) {
-      v.push_back(i);
-      if (static_cast<int>(v.size()) >= Nl) {
+      candidates.push_back(i);
+      if (static_cast<int>(candidates.size()) >= Nl) {
         return true;
       }
     }
   }
-
+  return HasNewNeighbor(q, sinfo);
+}
+//----------------------------------------------------------------------
+// A candidate pair breaks the list if it was out of the search length at
+// the last construction and is now within the cutoff. Candidates are binned
+// into cells of the cutoff length, so that only adjacent cells are tested
+// instead of all pairs of candidates.
+//----------------------------------------------------------------------
+bool
+PairList::HasNewNeighbor(double q[N][D], SimulationInfo *sinfo) {
   const double SL2 = sinfo->SearchLength * sinfo->SearchLength;
   const double CL2 = CUTOFF_LENGTH * CUTOFF_LENGTH;
+  const double icl = 1.0 / CUTOFF_LENGTH;
 
-  const int l = v.size();
+  const int l = candidates.size();
+  if (l < 2) return false;
+  cells.resize(l);
+  for (int k = 0; k < l; k++) {
+    const int i = candidates[k];
+    cells[k].ix = static_cast<int>(floor(q[i][X] * icl));
+    cells[k].iy = static_cast<int>(floor(q[i][Y] * icl));
+    cells[k].iz = static_cast<int>(floor(q[i][Z] * icl));
+    cells[k].index = i;
+  }
+  std::sort(cells.begin(), cells.end());
 
-  for (int i = 0; i < l - 1; i++) {
-    for (int j = i + 1; j < l; j++) {
-      int i1 = v[i];
-      int i2 = v[j];
-      double dx = qb_old[i1][X] - qb_old[i2][X];
-      double dy = qb_old[i1][Y] - qb_old[i2][Y];
-      double dz = qb_old[i1][Z] - qb_old[i2][Z];
-      double dr2 = dx * dx + dy * dy + dz * dz;
-      if (dr2 < SL2) continue;
-      dx = q[i1][X] - q[i2][X];
-      dy = q[i1][Y] - q[i2][Y];
-      dz = q[i1][Z] - q[i2][Z];
-      dr2 = dx * dx + dy * dy + dz * dz;
-      if (dr2 < CL2) return true;
+  for (int k = 0; k < l; k++) {
+    const int i1 = cells[k].index;
+    for (int jz = -1; jz <= 1; jz++) {
+      for (int jy = -1; jy <= 1; jy++) {
+        // Cells along x are contiguous in the sorted order
+        CandidateCell key = {cells[k].ix - 1, cells[k].iy + jy, cells[k].iz + jz, -1};
+        std::vector<CandidateCell>::iterator it = std::lower_bound(cells.begin(), cells.end(), key);
+        for (; it != cells.end(); ++it) {
+          if (it->iz != key.iz || it->iy != key.iy || it->ix > cells[k].ix + 1) break;
+          const int i2 = it->index;
+          if (i2 <= i1) continue;
+          double dx = qb_old[i1][X] - qb_old[i2][X];
+          double dy = qb_old[i1][Y] - qb_old[i2][Y];
+          double dz = qb_old[i1][Z] - qb_old[i2][Z];
+          double dr2 = dx * dx + dy * dy + dz * dz;
+          if (dr2 < SL2) continue;
+          dx = q[i1][X] - q[i2][X];
+          dy = q[i1][Y] - q[i2][Y];
+          dz = q[i1][Z] - q[i2][Z];
+          dr2 = dx * dx + dy * dy + dz * dz;
+          if (dr2 < CL2) return true;
+        }
+      }
     }
   }
   return false;
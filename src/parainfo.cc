@@ -64,6 +64,9 @@ ParaInfo::ParaInfo(int np_, int nt_, Parameter &param):
   openmp_grid_size[Z] = lz;
   ReadGlobalGrid(param);
   ReadLocalGrid(param);
+  if (param.GetStringDef("Decomposition", "Optimize") == "Optimize") {
+    OptimizeGrid(param);
+  }
   gx = mpi_grid_size[X];
   gy = mpi_grid_size[Y];
   gz = mpi_grid_size[Z];
@@ -141,6 +144,138 @@ ParaInfo::ReadLocalGrid(Parameter &param) {
   openmp_grid_size[Z] = lz;
 }
 //----------------------------------------------------------------------
+// Box length along the axis d, or 0 if it is not given explicitly
+// (with UnitLength it follows the unit grid)
+//----------------------------------------------------------------------
+double
+ParaInfo::GetBoxLength(Parameter &param, int d) {
+  const char *key[3] = {"SystemSizeX", "SystemSizeY", "SystemSizeZ"};
+  if (param.Contains(key[d])) {
+    return param.GetDouble(key[d]);
+  } else if (param.Contains("SystemSize")) {
+    return param.GetDouble("SystemSize");
+  }
+  return 0.0;
+}
+//----------------------------------------------------------------------
+// Volume of the ghost region around a box of widths w.
+// Ghosts are imported only along the exchanged axes.
+//----------------------------------------------------------------------
+double
+ParaInfo::GhostVolume(const double w[D], const bool exchanged[D], bool half_shell) {
+  const double SL = CUTOFF_LENGTH + BUFFER_LENGTH;
+  double v_all = 1.0;
+  double v_own = 1.0;
+  for (int d = 0; d < 3; d++) {
+    double g = 0.0;
+    if (exchanged[d]) {
+      g = (half_shell && d == Z) ? SL : 2.0 * SL;
+    }
+    v_all *= w[d] + g;
+    v_own *= w[d];
+  }
+  return v_all - v_own;
+}
+//----------------------------------------------------------------------
+// Choose MPI and local grids minimizing the total ghost volume of all
+// units. Ties are broken by the ghost volume crossing rank boundaries,
+// and then in favour of the legacy halving grid.
+// Units of a rank form a contiguous block, so neighbouring units share
+// the rank whenever the grid allows it.
+// Only a box given by its size is decomposed so. With UnitLength the
+// box is UnitLength times the grid, and the legacy grid is kept, so
+// that the system of such an input does not change.
+//----------------------------------------------------------------------
+void
+ParaInfo::OptimizeGrid(Parameter &param) {
+  const double SL = CUTOFF_LENGTH + BUFFER_LENGTH;
+  const bool half_shell = param.GetBooleanDef("HalfShell", false);
+  const bool fixed_global = param.Contains("GridX");
+  const bool fixed_local = param.Contains("LocalGridX");
+  for (int d = 0; d < 3; d++) {
+    if (GetBoxLength(param, d) <= 0.0) return;
+  }
+  std::vector<std::vector<int> > mpi_candidates;
+  std::vector<std::vector<int> > openmp_candidates;
+  for (int gx = 1; gx <= num_procs; gx++) {
+    if (num_procs % gx != 0) continue;
+    for (int gy = 1; gy <= num_procs / gx; gy++) {
+      if ((num_procs / gx) % gy != 0) continue;
+      std::vector<int> g = {gx, gy, num_procs / gx / gy};
+      mpi_candidates.push_back(g);
+    }
+  }
+  for (int lx = 1; lx <= num_threads; lx++) {
+    if (num_threads % lx != 0) continue;
+    for (int ly = 1; ly <= num_threads / lx; ly++) {
+      if ((num_threads / lx) % ly != 0) continue;
+      std::vector<int> l = {lx, ly, num_threads / lx / ly};
+      openmp_candidates.push_back(l);
+    }
+  }
+  // The current (legacy halving or user-given) grid is evaluated first
+  // so that it wins ties
+  mpi_candidates.insert(mpi_candidates.begin(),
+                        std::vector<int>(mpi_grid_size, mpi_grid_size + 3));
+  openmp_candidates.insert(openmp_candidates.begin(),
+                           std::vector<int>(openmp_grid_size, openmp_grid_size + 3));
+  if (fixed_global) {
+    mpi_candidates.resize(1);
+  }
+  if (fixed_local) {
+    openmp_candidates.resize(1);
+  }
+
+  bool found = false;
+  double best_total = 0.0;
+  double best_remote = 0.0;
+  double best_fraction = 0.0;
+  const double eps = 1e-9;
+  for (auto &g : mpi_candidates) {
+    for (auto &l : openmp_candidates) {
+      double w[D], W[D];
+      bool exchanged[D] = {true, true, true};
+      bool remote[D];
+      bool too_thin = false;
+      for (int d = 0; d < 3; d++) {
+        const double L = GetBoxLength(param, d);
+        W[d] = L / static_cast<double>(g[d]);
+        w[d] = W[d] / static_cast<double>(l[d]);
+        if (w[d] < SL) too_thin = true;
+        remote[d] = (g[d] > 1);
+      }
+      if (too_thin) continue;
+      const double ghost = GhostVolume(w, exchanged, half_shell);
+      const double total = ghost * static_cast<double>(num_procs * num_threads);
+      const double remote_total = GhostVolume(W, remote, half_shell) * static_cast<double>(num_procs);
+      const double scale = (found ? best_total : total) + 1.0;
+      bool better = !found;
+      if (found && total < best_total - eps * scale) {
+        better = true;
+      } else if (found && total < best_total + eps * scale && remote_total < best_remote - eps * scale) {
+        better = true;
+      }
+      if (!better) continue;
+      found = true;
+      best_total = total;
+      best_remote = remote_total;
+      best_fraction = ghost / (w[X] * w[Y] * w[Z]);
+      for (int d = 0; d < 3; d++) {
+        mpi_grid_size[d] = g[d];
+        openmp_grid_size[d] = l[d];
+      }
+    }
+  }
+  if (!found) {
+    show_warning("No decomposition keeps units wider than SearchLength. Legacy grid is used.");
+    return;
+  }
+  mout << "# MPI Grid = (" << mpi_grid_size[X] << "," << mpi_grid_size[Y] << "," << mpi_grid_size[Z] << ")";
+  mout << " Local Grid = (" << openmp_grid_size[X] << "," << openmp_grid_size[Y] << "," << openmp_grid_size[Z] << ")" << std::endl;
+  mout << "# Predicted ghost fraction = " << best_fraction;
+  mout << " (inter-rank " << best_remote / best_total << ")" << std::endl;
+}
+//----------------------------------------------------------------------
 void
 ParaInfo::SetGrid(void) {
   const int gx = mpi_grid_size[X];
@@ -77,19 +77,25 @@ void
 PhaseFlow::Run(MDManager *mdm) {
   Parameter *param = mdm->GetParameter();
   const double *L = mdm->GetSystemSize();
-  CylinderAdder ca(L, L[Y] * 0.25, 1.0, 0.374);
-  mdm->ExecuteAll(&ca);
   const double v0 = param->GetDoubleDef("InitialVelocity", 1.0);
   const double dt = param->GetDoubleDef("TimeStep", 0.001);
   mdm->SetControlTemperature(true);
-  mdm->SetInitialVelocity(v0);
-  mdm->SaveAsCdviewSequential();
+  if (!mdm->LoadInitialConfiguration(v0)) {
+    CylinderAdder ca(L, L[Y] * 0.25, 1.0, 0.374);
+    mdm->ExecuteAll(&ca);
+    mdm->SetInitialVelocity(v0);
+  }
+  // A restart goes on after the steps already taken
+  const int done = mdm->GetStepsInPhase();
+  if (done == 0) {
+    mdm->SaveAsCdviewSequential();
+  }
   const int OBSERVE_LOOP = param->GetIntegerDef("ObserveLoop", 100);
   const int TOTAL_LOOP = param->GetIntegerDef("TotalLoop", 1000);
   const bool save_cdview_file = param->GetBooleanDef("SaveCdviewFile", false);
   mdm->ShowSystemInformation();
   GravityImposer gi(0.2, dt);
-  for (int i = 0; i < TOTAL_LOOP; i++) {
+  for (int i = done; i < TOTAL_LOOP; i++) {
     mdm->Calculate();
     mdm->ExecuteAll(&gi);
     if (i % OBSERVE_LOOP == 0) {
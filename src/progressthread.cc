@@ -0,0 +1,34 @@
+//----------------------------------------------------------------------
+// Thread Driving the Progress of Nonblocking MPI Communication
+//----------------------------------------------------------------------
+#include <chrono>
+#include "communicator.h"
+#include "progressthread.h"
+//----------------------------------------------------------------------
+ProgressThread::ProgressThread(int interval_us) {
+  comm = Communicator::DuplicateWorld();
+  interval = interval_us;
+  polls = 0;
+  running = true;
+  thread = std::thread(&ProgressThread::Loop, this);
+}
+//----------------------------------------------------------------------
+ProgressThread::~ProgressThread(void) {
+  running = false;
+  thread.join();
+  Communicator::FreeComm(comm);
+}
+//----------------------------------------------------------------------
+void
+ProgressThread::Loop(void) {
+  while (running) {
+    Communicator::Progress(comm);
+    polls.fetch_add(1, std::memory_order_relaxed);
+    if (interval > 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(interval));
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+//----------------------------------------------------------------------
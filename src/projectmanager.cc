@@ -35,7 +35,12 @@ ProjectManager::ExecuteProject(MDManager *mdm) {
 
   Project *p = FindProject(mode.c_str());
   if (NULL != p) {
-    p->Run(mdm);
+    try {
+      p->Run(mdm);
+    } catch (StopRequest &r) {
+      mout << "# Mode " << mode << " stopped at step " << r.step << " (t = " << r.time
+           << "), continue with Restart=yes" << std::endl;
+    }
   } else {
     mout << "Mode " << mode << " is not found." << std::endl;
   }
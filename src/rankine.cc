@@ -98,49 +98,69 @@ public:
 void
 Rankine::Run(MDManager *mdm) {
   Parameter *param = mdm->GetParameter();
-  RankineConfigurationMaker c(param);
   MyPiston mp(param);
   const double LZ = param->GetDoubleDef("SystemSizeZ", 40);
   mp.position = LZ - 2.0;
-  mdm->ExecuteAll(&c);
   const double v0 = param->GetDoubleDef("InitialVelocity", 1.0);
-  mdm->SetInitialVelocity(v0);
+  if (!mdm->LoadInitialConfiguration(v0)) {
+    RankineConfigurationMaker c(param);
+    mdm->ExecuteAll(&c);
+    mdm->SetInitialVelocity(v0);
+  }
   const int LOOP = param->GetIntegerDef("TotalLoop", 1000);
   const int OBSERVE_LOOP = param->GetIntegerDef("ObserveLoop", 100);
   mdm->ShowSystemInformation();
   mdm->MakePairList();
   const double d_pos = LZ * 0.5 / LOOP;
 
-  //Push Piston
-  for (int i = 0; i < LOOP; i++) {
-    mdm->Calculate();
-    mdm->ExecuteAll(&mp);
+  // Phase 0 pushes the piston and phase 1 cools. A restart goes on after
+  // the steps already taken, with the piston moved as often as before.
+  const int pushed = (mdm->GetPhase() == 0) ? mdm->GetStepsInPhase() : LOOP;
+  for (int i = 0; i < pushed; i++) {
     mp.position -= d_pos;
-    if (i % OBSERVE_LOOP == 0) {
-      mout << mdm->GetSimulationTime();
-      mout << " " << mdm->Temperature();
-      mout << " " << mdm->Pressure();
-      mout << " " << mdm->TotalEnergy();
-      mout << " " << mp.position;
-      mout << " " << mp.impulse;
-      mout << " #observe" << std::endl;
-      mdm->SaveAsCdviewSequential();
+  }
+
+  //Push Piston
+  if (mdm->GetPhase() == 0) {
+    for (int i = pushed; i < LOOP; i++) {
+      mdm->Calculate();
+      mdm->ExecuteAll(&mp);
+      mp.position -= d_pos;
+      if (i % OBSERVE_LOOP == 0) {
+        ThermoSnapshot ts = mdm->TakeThermoSnapshot();
+        mout << mdm->GetSimulationTime();
+        mout << " " << ts.Temperature();
+        mout << " " << ts.Pressure();
+        mout << " " << ts.TotalEnergy();
+        mout << " " << mp.position;
+        mout << " " << mp.impulse;
+        mout << " #observe" << std::endl;
+        mout.Field("piston_position", mp.position);
+        mout.Field("piston_impulse", mp.impulse);
+        mdm->RecordObservables("observe", ts);
+        mdm->SaveAsCdviewSequential();
+      }
     }
+    mdm->SetPhase(1);
   }
   // Cooling
   mdm->SetControlTemperature(true);
   mdm->SetAimedTemperature(0.5);
-  for (int i = 0; i < LOOP; i++) {
+  for (int i = mdm->GetStepsInPhase(); i < LOOP; i++) {
     mdm->Calculate();
     mdm->ExecuteAll(&mp);
     if (i % OBSERVE_LOOP == 0) {
+      ThermoSnapshot ts = mdm->TakeThermoSnapshot();
       mout << mdm->GetSimulationTime();
-      mout << " " << mdm->Temperature();
-      mout << " " << mdm->Pressure();
-      mout << " " << mdm->TotalEnergy();
+      mout << " " << ts.Temperature();
+      mout << " " << ts.Pressure();
+      mout << " " << ts.TotalEnergy();
       mout << " " << mp.position;
       mout << " " << mp.impulse;
       mout << " #observe" << std::endl;
+      mout.Field("piston_position", mp.position);
+      mout.Field("piston_impulse", mp.impulse);
+      mdm->RecordObservables("observe", ts);
       mdm->SaveAsCdviewSequential();
     }
   }
@@ -3,7 +3,7 @@
 #include "simulationinfo.h"
 //----------------------------------------------------------------------
 SimulationInfo::SimulationInfo(Parameter &param, int *grid_size) {
-  BufferLength = 0.3;
+  BufferLength = BUFFER_LENGTH;
   SearchLength = CUTOFF_LENGTH + BufferLength;
   BaseDir = ".";
   TimeStep = param.GetDoubleDef("TimeStep", 0.001);
@@ -14,6 +14,14 @@ SimulationInfo::SimulationInfo(Parameter &param, int *grid_size) {
   HeatbathGamma = param.GetDoubleDef("HeatbathGamma", 0.1);
   BaseDir = param.GetStringDef("BaseDir", ".");
   SortParticle = param.GetBooleanDef("SortParticle", false);
+  HalfShell = param.GetBooleanDef("HalfShell", false);
+  SparseMesh = param.GetBooleanDef("SparseMesh", false);
+#if defined FX10 || defined USE_GPU
+  if (HalfShell) {
+    show_warning("HalfShell is not supported with reactless force kernels. Disabled.");
+    HalfShell = false;
+  }
+#endif
 
   std::string hbtype = param.GetStringDef("HeatbathType", "NoseHoover");
 
@@ -71,6 +79,7 @@ SimulationInfo::ShowAll(unsigned long int pn) {
     }
   }
   mout << "# IsPeriodic = " << (IsPeriodic ? "yes" : "no") << std::endl;
+  mout << "# HalfShell = " << (HalfShell ? "yes" : "no") << std::endl;
 }
 //----------------------------------------------------------------------
 void
@@ -0,0 +1,173 @@
+//----------------------------------------------------------------------
+// Asynchronous Snapshot Output and In-situ Analysis
+//----------------------------------------------------------------------
+#include <stdio.h>
+#include "communicator.h"
+#include "snapshotwriter.h"
+#include "textformat.h"
+//----------------------------------------------------------------------
+bool
+CdviewSnapshotTask::Process(Snapshot &s, MPI_Comm comm) {
+  std::string text;
+  for (unsigned int i = 0; i < s.records.size(); i++) {
+    const CheckpointRecord &r = s.records[i];
+    TextFormat::AppendCdviewLine(text, r.type, r.q, r.p);
+  }
+  std::vector<char> buffer(text.begin(), text.end());
+  return Communicator::WriteOrderedBytes(filename.c_str(), buffer, comm);
+}
+//----------------------------------------------------------------------
+// Every rank writes the particles of its units as one block, since the
+// units of a rank have consecutive ids.
+//----------------------------------------------------------------------
+bool
+CheckpointSnapshotTask::Process(Snapshot &s, MPI_Comm comm) {
+  int rank, num_procs;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &num_procs);
+  const int num_units = s.counts.size();
+  std::vector<int> all_counts(num_units * num_procs);
+  Communicator::AllGatherInteger(&s.counts[0], num_units, &all_counts[0], comm);
+  std::vector<int64_t> counts(all_counts.begin(), all_counts.end());
+  int64_t index = 0;
+  total = 0;
+  for (unsigned int id = 0; id < counts.size(); id++) {
+    if (static_cast<int>(id) < rank * num_units) index += counts[id];
+    total += counts[id];
+  }
+
+  CheckpointHeader header;
+  header.num_particles = total;
+  for (int d = 0; d < 3; d++) {
+    header.L[d] = s.L[d];
+  }
+  header.time = s.time;
+  header.zeta = s.zeta;
+  header.step = s.step;
+  header.phase_step = s.phase_step;
+  header.phase = s.phase;
+  header.frame = s.frame;
+
+  const std::string target = (keep > 0) ? filename + ".tmp" : filename;
+  {
+    CheckpointFile file(target.c_str(), true, comm);
+    if (!file.IsOpened()) return false;
+    file.WriteHeader(header, counts);
+    file.WriteRecords(index, s.records);
+  }
+  if (keep <= 0) return true;
+  // The file is complete on all ranks before it is renamed, and renamed
+  // before any rank opens the next one
+  MPI_Barrier(comm);
+  bool renamed = true;
+  if (rank == 0) {
+    for (int i = keep - 1; i > 0; i--) {
+      rename(GetRotatedName(i - 1).c_str(), GetRotatedName(i).c_str());
+    }
+    renamed = (rename(target.c_str(), filename.c_str()) == 0);
+  }
+  MPI_Barrier(comm);
+  return renamed;
+}
+//----------------------------------------------------------------------
+std::string
+CheckpointSnapshotTask::GetRotatedName(int index) {
+  if (index == 0) return filename;
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), ".%d", index);
+  return filename + suffix;
+}
+//----------------------------------------------------------------------
+SnapshotWriter::SnapshotWriter(int num_buffers) {
+  comm = Communicator::DuplicateWorld();
+  if (num_buffers < 1) num_buffers = 1;
+  buffers.resize(num_buffers);
+  for (int i = 0; i < num_buffers; i++) {
+    buffers[i] = new Snapshot;
+    free_buffers.push_back(buffers[i]);
+  }
+  running = true;
+  working = false;
+  submitted = 0;
+  failed = 0;
+  acquired_time = 0.0;
+  stage_time = 0.0;
+  stall_time = 0.0;
+  work_time = 0.0;
+  thread = std::thread(&SnapshotWriter::Loop, this);
+}
+//----------------------------------------------------------------------
+SnapshotWriter::~SnapshotWriter(void) {
+  Flush();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    running = false;
+  }
+  cond.notify_all();
+  thread.join();
+  Communicator::FreeComm(comm);
+  for (unsigned int i = 0; i < buffers.size(); i++) {
+    delete buffers[i];
+  }
+}
+//----------------------------------------------------------------------
+void
+SnapshotWriter::Loop(void) {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    cond.wait(lock, [this] {return !queue.empty() || !running;});
+    if (queue.empty()) break;
+    Job job = queue.front();
+    queue.pop_front();
+    working = true;
+    lock.unlock();
+    const double t = Communicator::GetTime();
+    const bool success = job.task->Process(*job.snapshot, comm);
+    if (job.owned) delete job.task;
+    const double elapsed = Communicator::GetTime() - t;
+    lock.lock();
+    if (!success) failed++;
+    work_time += elapsed;
+    working = false;
+    free_buffers.push_back(job.snapshot);
+    cond.notify_all();
+  }
+}
+//----------------------------------------------------------------------
+// Blocks while all the staging buffers are queued (back-pressure)
+//----------------------------------------------------------------------
+Snapshot *
+SnapshotWriter::Acquire(void) {
+  const double t = Communicator::GetTime();
+  std::unique_lock<std::mutex> lock(mutex);
+  cond.wait(lock, [this] {return !free_buffers.empty();});
+  Snapshot *s = free_buffers.back();
+  free_buffers.pop_back();
+  acquired_time = Communicator::GetTime();
+  stall_time += acquired_time - t;
+  return s;
+}
+//----------------------------------------------------------------------
+void
+SnapshotWriter::Submit(Snapshot *s, SnapshotTask *task, bool owned) {
+  Job job;
+  job.snapshot = s;
+  job.task = task;
+  job.owned = owned;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stage_time += Communicator::GetTime() - acquired_time;
+    submitted++;
+    queue.push_back(job);
+  }
+  cond.notify_all();
+}
+//----------------------------------------------------------------------
+void
+SnapshotWriter::Flush(void) {
+  const double t = Communicator::GetTime();
+  std::unique_lock<std::mutex> lock(mutex);
+  cond.wait(lock, [this] {return queue.empty() && !working;});
+  stall_time += Communicator::GetTime() - t;
+}
+//----------------------------------------------------------------------
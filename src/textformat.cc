@@ -0,0 +1,131 @@
+//----------------------------------------------------------------------
+// Fast Float-to-text Conversion for Text Snapshots
+//----------------------------------------------------------------------
+#include <stdio.h>
+#include <math.h>
+#include "textformat.h"
+//----------------------------------------------------------------------
+namespace {
+const double POW10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+const int MAX_POW10 = 22;
+// Absolute error of the scaled mantissa (below 1e6) allowed before the
+// rounding is left to snprintf
+const double TIE_MARGIN = 1e-7;
+//----------------------------------------------------------------------
+int
+WriteInteger(unsigned int v, char *s) {
+  char digits[16];
+  int n = 0;
+  do {
+    digits[n++] = static_cast<char>('0' + v % 10);
+    v /= 10;
+  } while (v > 0);
+  for (int i = 0; i < n; i++) {
+    s[i] = digits[n - 1 - i];
+  }
+  return n;
+}
+//----------------------------------------------------------------------
+// a * 10^k with one rounding, or a negative value if 10^|k| is not exact
+double
+Scale(double a, int k) {
+  if (k > MAX_POW10 || k < -MAX_POW10) return -1.0;
+  return (k >= 0) ? a * POW10[k] : a / POW10[-k];
+}
+}
+//----------------------------------------------------------------------
+// The six significant digits are found as an integer from the value
+// scaled by an exact power of ten. The scaled value is off by a few
+// ulps at most, so the rounding is exact unless it lies within
+// TIE_MARGIN of a tie. Those values, and the exponents outside of the
+// exact powers, are left to snprintf.
+//----------------------------------------------------------------------
+int
+TextFormat::General(double value, char *buffer) {
+  if (value == 0.0) {
+    if (signbit(value)) {
+      buffer[0] = '-';
+      buffer[1] = '0';
+      return 2;
+    }
+    buffer[0] = '0';
+    return 1;
+  }
+  if (!isfinite(value)) return snprintf(buffer, 32, "%g", value);
+  const double a = fabs(value);
+  int e = static_cast<int>(floor(log10(a)));
+  double scaled = Scale(a, 5 - e);
+  if (scaled >= 1e6) {
+    e++;
+    scaled = Scale(a, 5 - e);
+  } else if (scaled >= 0.0 && scaled < 1e5) {
+    e--;
+    scaled = Scale(a, 5 - e);
+  }
+  if (scaled < 1e5 || scaled >= 1e6) return snprintf(buffer, 32, "%g", value);
+  unsigned int m = static_cast<unsigned int>(scaled);
+  const double frac = scaled - m;
+  if (fabs(frac - 0.5) < TIE_MARGIN) return snprintf(buffer, 32, "%g", value);
+  if (frac > 0.5) m++;
+  if (m == 1000000) {
+    m = 100000;
+    e++;
+  }
+  char digits[8];
+  WriteInteger(m, digits);
+  int last = 5;
+  while (last > 0 && digits[last] == '0') last--;
+  char *s = buffer;
+  if (value < 0.0) *s++ = '-';
+  if (e < -4 || e >= 6) {
+    *s++ = digits[0];
+    if (last > 0) {
+      *s++ = '.';
+      for (int i = 1; i <= last; i++) *s++ = digits[i];
+    }
+    *s++ = 'e';
+    *s++ = (e < 0) ? '-' : '+';
+    const unsigned int x = (e < 0) ? -e : e;
+    if (x < 10) *s++ = '0';
+    s += WriteInteger(x, s);
+  } else if (e >= 0) {
+    for (int i = 0; i <= e; i++) *s++ = digits[i];
+    if (last > e) {
+      *s++ = '.';
+      for (int i = e + 1; i <= last; i++) *s++ = digits[i];
+    }
+  } else {
+    *s++ = '0';
+    *s++ = '.';
+    for (int i = 0; i < -e - 1; i++) *s++ = '0';
+    for (int i = 0; i <= last; i++) *s++ = digits[i];
+  }
+  return static_cast<int>(s - buffer);
+}
+//----------------------------------------------------------------------
+void
+TextFormat::AppendCdviewLine(std::string &buffer, int type, const double *q, const double *p) {
+  char line[256];
+  char *s = line;
+  *s++ = '0';
+  *s++ = ' ';
+  if (type < 0) {
+    *s++ = '-';
+    type = -type;
+  }
+  s += WriteInteger(static_cast<unsigned int>(type), s);
+  for (int d = 0; d < 3; d++) {
+    *s++ = ' ';
+    s += General(q[d], s);
+  }
+  for (int d = 0; d < 3; d++) {
+    *s++ = ' ';
+    s += General(p[d], s);
+  }
+  *s++ = '\n';
+  buffer.append(line, s - line);
+}
+//----------------------------------------------------------------------
@@ -0,0 +1,87 @@
+//----------------------------------------------------------------------
+#include "communicator.h"
+#include "thermosnapshot.h"
+//----------------------------------------------------------------------
+ThermoSnapshot::ThermoSnapshot(void) {
+  Clear();
+  volume = 1.0;
+}
+//----------------------------------------------------------------------
+void
+ThermoSnapshot::Clear(void) {
+  for (int k = 0; k < S_SIZE; k++) {
+    value[k] = 0.0;
+  }
+}
+//----------------------------------------------------------------------
+// Same sums as KineticEnergyObserver, PotentialEnergyObserver and
+// VirialObserver, with the two pair sums sharing one sweep.
+//----------------------------------------------------------------------
+void
+ThermoSnapshot::Observe(Variables *vars, MeshList *mesh) {
+  double (*q)[D] = vars->q;
+  double (*p)[D] = vars->p;
+  int *type = vars->type;
+  const int pn = vars->GetParticleNumber();
+  double kinetic = 0.0;
+  for (int i = 0; i < pn; i++) {
+    for (int d = 0; d < D; d++) {
+      kinetic += 0.5 * p[i][d] * p[i][d];
+    }
+    const int t = type[i];
+    if (t >= 0 && t < MAX_TYPE) {
+      value[S_TYPE + t] += 1.0;
+    }
+  }
+
+  const double CL2 = CUTOFF_LENGTH * CUTOFF_LENGTH;
+  const double C2 = vars->GetC2();
+  const double C0 = vars->GetC0();
+  const int s = mesh->GetPairNumber();
+  int (*key_partner_pairs)[2] = mesh->GetKeyPartnerPairs();
+  double energy = 0.0;
+  double phi = 0.0;
+  for (int k = 0; k < s; k++) {
+    int i = key_partner_pairs[k][MeshList::KEY];
+    int j = key_partner_pairs[k][MeshList::PARTNER];
+    double dx = q[i][X] - q[j][X];
+    double dy = q[i][Y] - q[j][Y];
+    double dz = q[i][Z] - q[j][Z];
+    const double r2 = (dx * dx + dy * dy + dz * dz);
+    if (r2 > CL2) continue;
+    const double r6 = r2 * r2 * r2;
+    double e = 4.0 * (1.0 / (r2 * r2 * r2 * r2 * r2 * r2) - 1.0 / (r2 * r2 * r2) + C2 * r2 + C0);
+    double df = ((24.0 * r6 - 48.0) / (r6 * r6 * r2) + C2 * 8.0) * r2;
+    if ((i >= pn || j >= pn) && !mesh->IsHalfShell()) {
+      e *= 0.5;
+      df *= 0.5;
+    }
+    energy += e;
+    phi += df;
+  }
+#if defined FX10 || defined USE_GPU
+  energy *= 0.5;
+  phi *= 0.5;
+#endif
+  value[S_KINETIC] += kinetic;
+  value[S_POTENTIAL] += energy;
+  value[S_VIRIAL] += phi / 3.0;
+  value[S_NUMBER] += static_cast<double>(pn);
+}
+//----------------------------------------------------------------------
+void
+ThermoSnapshot::Add(const ThermoSnapshot &s) {
+  for (int k = 0; k < S_SIZE; k++) {
+    value[k] += s.value[k];
+  }
+}
+//----------------------------------------------------------------------
+void
+ThermoSnapshot::Reduce(void) {
+  double local[S_SIZE];
+  for (int k = 0; k < S_SIZE; k++) {
+    local[k] = value[k];
+  }
+  Communicator::AllReduceDoubleBuffer(local, S_SIZE, value);
+}
+//----------------------------------------------------------------------
@@ -0,0 +1,314 @@
+//----------------------------------------------------------------------
+// Compressed Encodings of the Trajectory Particles
+//----------------------------------------------------------------------
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include "trajectorycodec.h"
+//----------------------------------------------------------------------
+namespace {
+//----------------------------------------------------------------------
+struct CellOrder {
+  const double *origin;
+  CellOrder(const double *o) : origin(o) {};
+  bool operator()(const TrajectoryParticle &a, const TrajectoryParticle &b) const {
+    for (int d = 2; d >= 0; d--) {
+      const double ca = floor(a.q[d] - origin[d]);
+      const double cb = floor(b.q[d] - origin[d]);
+      if (ca != cb) return ca < cb;
+    }
+    return a.q[0] < b.q[0];
+  };
+};
+//----------------------------------------------------------------------
+inline uint64_t
+ZigZag(int64_t v) {
+  return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+//----------------------------------------------------------------------
+inline int64_t
+UnZigZag(uint64_t v) {
+  return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+//----------------------------------------------------------------------
+inline int
+BitWidth(uint64_t v) {
+  int w = 0;
+  while (v) {
+    v >>= 1;
+    w++;
+  }
+  return w;
+}
+//----------------------------------------------------------------------
+inline int
+ByteWidth(uint64_t v) {
+  int w = 0;
+  while (v) {
+    v >>= 8;
+    w++;
+  }
+  return w;
+}
+//----------------------------------------------------------------------
+inline uint64_t
+LowMask(int k) {
+  return (k == 64) ? ~0ULL : ((1ULL << k) - 1);
+}
+//----------------------------------------------------------------------
+inline uint64_t
+DoubleBits(double x) {
+  uint64_t u;
+  memcpy(&u, &x, sizeof(u));
+  return u;
+}
+//----------------------------------------------------------------------
+inline double
+BitsDouble(uint64_t u) {
+  double x;
+  memcpy(&x, &u, sizeof(x));
+  return x;
+}
+//----------------------------------------------------------------------
+class BitWriter {
+private:
+  std::vector<char> &out;
+  uint64_t acc;
+  int n;
+public:
+  BitWriter(std::vector<char> &o) : out(o), acc(0), n(0) {};
+  void Put(uint64_t v, int w) {
+    int i = 0;
+    while (i < w) {
+      const int k = std::min(w - i, 64 - n);
+      acc |= ((v >> i) & LowMask(k)) << n;
+      n += k;
+      i += k;
+      if (n == 64) {
+        out.insert(out.end(), reinterpret_cast<char *>(&acc), reinterpret_cast<char *>(&acc) + 8);
+        acc = 0;
+        n = 0;
+      }
+    }
+  };
+  void Flush(void) {
+    const int bytes = (n + 7) / 8;
+    out.insert(out.end(), reinterpret_cast<char *>(&acc), reinterpret_cast<char *>(&acc) + bytes);
+    acc = 0;
+    n = 0;
+  };
+};
+//----------------------------------------------------------------------
+class BitReader {
+private:
+  const unsigned char *data;
+  int64_t pos;
+public:
+  BitReader(const char *d) : data(reinterpret_cast<const unsigned char *>(d)), pos(0) {};
+  uint64_t Get(int w) {
+    uint64_t v = 0;
+    for (int i = 0; i < w; ) {
+      const int bit = pos & 7;
+      const int k = std::min(w - i, 8 - bit);
+      const uint64_t b = (data[pos >> 3] >> bit) & LowMask(k);
+      v |= b << i;
+      i += k;
+      pos += k;
+    }
+    return v;
+  };
+};
+//----------------------------------------------------------------------
+void
+EncodeQuantized(TrajectoryChunk &c, std::vector<TrajectoryParticle> &particles, std::vector<char> &out) {
+  const int n = particles.size();
+  const double inv = 1.0 / c.precision;
+  const double minv = 1.0 / c.momentum_precision;
+  std::vector<uint64_t> v(n * 6);
+  int64_t prev[3] = {0, 0, 0};
+  for (int i = 0; i < n; i++) {
+    for (int d = 0; d < 3; d++) {
+      const int64_t qi = llround((particles[i].q[d] - c.origin[d]) * inv);
+      v[i * 6 + d] = ZigZag(qi - prev[d]);
+      prev[d] = qi;
+      v[i * 6 + 3 + d] = ZigZag(llround(particles[i].p[d] * minv));
+    }
+  }
+  int width[6] = {0, 0, 0, 0, 0, 0};
+  for (int i = 0; i < n; i++) {
+    for (int k = 0; k < 6; k++) {
+      width[k] = std::max(width[k], BitWidth(v[i * 6 + k]));
+    }
+  }
+  for (int k = 0; k < 6; k++) {
+    c.width[k] = width[k];
+  }
+  BitWriter bw(out);
+  for (int i = 0; i < n; i++) {
+    for (int k = 0; k < 6; k++) {
+      bw.Put(v[i * 6 + k], width[k]);
+    }
+  }
+  bw.Flush();
+}
+//----------------------------------------------------------------------
+void
+DecodeQuantized(const TrajectoryChunk &c, const char *data, std::vector<TrajectoryParticle> &particles) {
+  BitReader br(data);
+  int64_t prev[3] = {0, 0, 0};
+  for (int64_t i = 0; i < c.num_particles; i++) {
+    TrajectoryParticle tp;
+    for (int d = 0; d < 3; d++) {
+      prev[d] += UnZigZag(br.Get(c.width[d]));
+      tp.q[d] = c.origin[d] + static_cast<double>(prev[d]) * c.precision;
+    }
+    for (int d = 0; d < 3; d++) {
+      tp.p[d] = static_cast<double>(UnZigZag(br.Get(c.width[3 + d]))) * c.momentum_precision;
+    }
+    particles.push_back(tp);
+  }
+}
+//----------------------------------------------------------------------
+inline void
+PutLowBytes(std::vector<char> &out, uint64_t v, int bytes) {
+  for (int b = 0; b < bytes; b++) {
+    out.push_back(static_cast<char>(v >> (8 * b)));
+  }
+}
+//----------------------------------------------------------------------
+inline uint64_t
+GetLowBytes(const unsigned char *&data, int bytes) {
+  uint64_t v = 0;
+  for (int b = 0; b < bytes; b++) {
+    v |= static_cast<uint64_t>(*data++) << (8 * b);
+  }
+  return v;
+}
+//----------------------------------------------------------------------
+// The six components of a particle are stored as three pairs, each with
+// a control byte holding the two byte counts.
+//----------------------------------------------------------------------
+void
+EncodeLossless(std::vector<TrajectoryParticle> &particles, std::vector<char> &out) {
+  uint64_t prev[6] = {0, 0, 0, 0, 0, 0};
+  for (unsigned int i = 0; i < particles.size(); i++) {
+    uint64_t x[6];
+    for (int d = 0; d < 3; d++) {
+      x[d] = DoubleBits(particles[i].q[d]);
+      x[3 + d] = DoubleBits(particles[i].p[d]);
+    }
+    for (int k = 0; k < 6; k += 2) {
+      const uint64_t a = x[k] ^ prev[k];
+      const uint64_t b = x[k + 1] ^ prev[k + 1];
+      const int na = ByteWidth(a);
+      const int nb = ByteWidth(b);
+      out.push_back(static_cast<char>(na | (nb << 4)));
+      PutLowBytes(out, a, na);
+      PutLowBytes(out, b, nb);
+    }
+    for (int k = 0; k < 6; k++) {
+      prev[k] = x[k];
+    }
+  }
+}
+//----------------------------------------------------------------------
+// Stops at a pair which does not fit before end
+void
+DecodeLossless(const TrajectoryChunk &c, const char *data, const char *end,
+               std::vector<TrajectoryParticle> &particles) {
+  const unsigned char *d = reinterpret_cast<const unsigned char *>(data);
+  const unsigned char *e = reinterpret_cast<const unsigned char *>(end);
+  uint64_t prev[6] = {0, 0, 0, 0, 0, 0};
+  for (int64_t i = 0; i < c.num_particles; i++) {
+    for (int k = 0; k < 6; k += 2) {
+      if (d >= e) return;
+      const int control = *d++;
+      if ((control & 15) > 8 || (control >> 4) > 8 || e - d < (control & 15) + (control >> 4)) return;
+      prev[k] ^= GetLowBytes(d, control & 15);
+      prev[k + 1] ^= GetLowBytes(d, control >> 4);
+    }
+    TrajectoryParticle tp;
+    for (int j = 0; j < 3; j++) {
+      tp.q[j] = BitsDouble(prev[j]);
+      tp.p[j] = BitsDouble(prev[3 + j]);
+    }
+    particles.push_back(tp);
+  }
+}
+//----------------------------------------------------------------------
+}
+//----------------------------------------------------------------------
+const char *
+TrajectoryCodec::GetName(int codec) {
+  switch (codec) {
+  case RAW:
+    return "raw";
+  case QUANTIZED:
+    return "quantized";
+  case LOSSLESS:
+    return "lossless";
+  }
+  return "unknown";
+}
+//----------------------------------------------------------------------
+int
+TrajectoryCodec::GetCodec(const char *name) {
+  for (int codec = RAW; codec <= LOSSLESS; codec++) {
+    if (strcmp(name, GetName(codec)) == 0) return codec;
+  }
+  return -1;
+}
+//----------------------------------------------------------------------
+void
+TrajectoryCodec::Encode(int codec, const double origin[3], double precision, double momentum_precision,
+                        std::vector<TrajectoryParticle> &particles, std::vector<char> &out) {
+  std::sort(particles.begin(), particles.end(), CellOrder(origin));
+  TrajectoryChunk c;
+  memset(&c, 0, sizeof(c));
+  c.num_particles = particles.size();
+  for (int d = 0; d < 3; d++) {
+    c.origin[d] = origin[d];
+  }
+  c.precision = precision;
+  c.momentum_precision = momentum_precision;
+  const size_t start = out.size();
+  out.resize(start + sizeof(c));
+  if (codec == QUANTIZED) {
+    EncodeQuantized(c, particles, out);
+  } else {
+    EncodeLossless(particles, out);
+  }
+  c.bytes = out.size() - start;
+  memcpy(&out[start], &c, sizeof(c));
+}
+//----------------------------------------------------------------------
+// The chunk header is trusted only as far as its own size allows: the
+// payload must hold every particle, or nothing is decoded.
+//----------------------------------------------------------------------
+int64_t
+TrajectoryCodec::Decode(int codec, const char *data, std::vector<TrajectoryParticle> &particles) {
+  TrajectoryChunk c;
+  memcpy(&c, data, sizeof(c));
+  const int64_t payload = c.bytes - static_cast<int64_t>(sizeof(c));
+  if (payload < 0 || c.num_particles < 0) return -1;
+  const size_t first = particles.size();
+  if (codec == QUANTIZED) {
+    int64_t bits = 0;
+    for (int d = 0; d < 6; d++) {
+      if (c.width[d] > 64) return -1;
+      bits += c.width[d];
+    }
+    if (bits > 0 && c.num_particles > payload * 8 / bits) return -1;
+    DecodeQuantized(c, data + sizeof(c), particles);
+  } else {
+    // Each particle takes at least its three control bytes
+    if (c.num_particles > payload / 3) return -1;
+    DecodeLossless(c, data + sizeof(c), data + c.bytes, particles);
+  }
+  if (static_cast<int64_t>(particles.size() - first) != c.num_particles) {
+    particles.resize(first);
+    return -1;
+  }
+  return c.bytes;
+}
+//----------------------------------------------------------------------
@@ -0,0 +1,250 @@
+//----------------------------------------------------------------------
+// Collective Writer of the Binary Trajectory Container
+//----------------------------------------------------------------------
+#include <string.h>
+#include <algorithm>
+#include <omp.h>
+#include "communicator.h"
+#include "trajectorywriter.h"
+//----------------------------------------------------------------------
+TrajectoryWriter::TrajectoryWriter(const char *f, bool append_, int codec_, double precision_,
+                                   double momentum_precision_, int num_threads_) : filename(f) {
+  append = append_;
+  opened = false;
+  codec = codec_;
+  precision = precision_;
+  momentum_precision = momentum_precision_;
+  num_threads = std::max(num_threads_, 1);
+  end_offset = sizeof(TrajectoryHeader);
+  raw_bytes = 0.0;
+  encoded_bytes = 0.0;
+  encode_time = 0.0;
+}
+//----------------------------------------------------------------------
+// Every rank reads the same bytes, so all take the same decision. The
+// frames are found from their headers, which does not rely on an index
+// left by a job that died while appending.
+//----------------------------------------------------------------------
+bool
+TrajectoryWriter::ReadIndex(MPI_File fh) {
+  TrajectoryHeader header;
+  MPI_Status st;
+  int n = 0;
+  MPI_File_read_at(fh, 0, &header, sizeof(header), MPI_BYTE, &st);
+  MPI_Get_count(&st, MPI_BYTE, &n);
+  if (n != static_cast<int>(sizeof(header))) return false;
+  if (memcmp(header.magic, TrajectoryFile::MAGIC, sizeof(header.magic)) != 0) return false;
+  if (header.version != TrajectoryFile::VERSION) return false;
+  if (header.record_size != static_cast<int>(sizeof(TrajectoryRecord))) return false;
+  MPI_Offset file_size;
+  MPI_File_get_size(fh, &file_size);
+  const int64_t end = std::min(header.end_offset, static_cast<int64_t>(file_size));
+  index.clear();
+  int64_t offset = sizeof(TrajectoryHeader);
+  while (offset + static_cast<int64_t>(sizeof(TrajectoryFrameHeader)) <= end) {
+    TrajectoryFrameHeader fr;
+    MPI_File_read_at(fh, offset, &fr, sizeof(fr), MPI_BYTE, &st);
+    MPI_Get_count(&st, MPI_BYTE, &n);
+    if (n != static_cast<int>(sizeof(fr))) break;
+    if (memcmp(fr.magic, TrajectoryFile::FRAME_MAGIC, sizeof(fr.magic)) != 0) break;
+    if (fr.num_types < 0 || fr.num_types > TrajectoryFile::MAX_TYPES) break;
+    std::vector<int64_t> sizes(2 * fr.num_types + 1, 0);
+    MPI_File_read_at(fh, offset + sizeof(fr), &sizes[0], sizeof(int64_t) * 2 * fr.num_types,
+                     MPI_BYTE, MPI_STATUS_IGNORE);
+    int64_t bytes = 0;
+    for (int t = 0; t < fr.num_types; t++) {
+      bytes += sizes[fr.num_types + t];
+    }
+    const int64_t frame_size = TrajectoryFile::FrameSize(fr.num_types, bytes);
+    if (offset + frame_size > end) break;
+    TrajectoryIndexEntry e;
+    e.offset = offset;
+    e.num_particles = fr.num_particles;
+    e.bytes = frame_size;
+    e.time = fr.time;
+    e.num_types = fr.num_types;
+    e.codec = fr.codec;
+    index.push_back(e);
+    offset += frame_size;
+  }
+  end_offset = offset;
+  return true;
+}
+//----------------------------------------------------------------------
+// An existing file is only truncated without append. With append, a
+// file which is not empty and not a valid container is left untouched
+// and the writer refuses to write.
+//----------------------------------------------------------------------
+bool
+TrajectoryWriter::Open(MPI_Comm comm) {
+  opened = false;
+  MPI_File fh;
+  if (MPI_File_open(comm, const_cast<char *>(filename.c_str()), MPI_MODE_CREATE | MPI_MODE_RDWR,
+                    MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+    return false;
+  }
+  MPI_Offset file_size;
+  MPI_File_get_size(fh, &file_size);
+  index.clear();
+  end_offset = sizeof(TrajectoryHeader);
+  if (!append) {
+    MPI_File_set_size(fh, 0);
+    opened = true;
+  } else if (file_size == 0) {
+    opened = true;
+  } else {
+    opened = ReadIndex(fh);
+  }
+  MPI_File_close(&fh);
+  return opened;
+}
+//----------------------------------------------------------------------
+// offset: position of the first particle of the unit in the snapshot
+//----------------------------------------------------------------------
+void
+TrajectoryWriter::EncodeUnit(Snapshot &s, int u, int offset, int num_types) {
+  std::vector<std::vector<char> > &data = unit_data[u];
+  data.resize(num_types);
+  for (int t = 0; t < num_types; t++) {
+    data[t].clear();
+  }
+  const CheckpointRecord *r = s.records.data() + offset;
+  const int pn = s.counts[u];
+  if (codec == TrajectoryCodec::RAW) {
+    for (int i = 0; i < pn; i++) {
+      TrajectoryRecord tr;
+      for (int d = 0; d < 3; d++) {
+        tr.q[d] = static_cast<float>(r[i].q[d]);
+        tr.p[d] = static_cast<float>(r[i].p[d]);
+      }
+      const char *b = reinterpret_cast<const char *>(&tr);
+      data[r[i].type].insert(data[r[i].type].end(), b, b + sizeof(tr));
+    }
+    return;
+  }
+  std::vector<std::vector<TrajectoryParticle> > particles(num_types);
+  for (int i = 0; i < pn; i++) {
+    TrajectoryParticle tp;
+    for (int d = 0; d < 3; d++) {
+      tp.q[d] = r[i].q[d];
+      tp.p[d] = r[i].p[d];
+    }
+    particles[r[i].type].push_back(tp);
+  }
+  for (int t = 0; t < num_types; t++) {
+    if (particles[t].empty()) continue;
+    TrajectoryCodec::Encode(codec, &s.origins[u * 3], precision, momentum_precision,
+                            particles[t], data[t]);
+  }
+}
+//----------------------------------------------------------------------
+bool
+TrajectoryWriter::Process(Snapshot &s, MPI_Comm comm) {
+  if (!opened) return false;
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  const int pn = s.records.size();
+  int max_type = -1;
+  for (int i = 0; i < pn; i++) {
+    const int t = s.records[i].type;
+    max_type = std::max(max_type, (t < 0) ? TrajectoryFile::MAX_TYPES : t);
+  }
+  const int num_types = Communicator::FindMaxInteger(max_type, comm) + 1;
+  if (num_types > TrajectoryFile::MAX_TYPES) return false;
+
+  // Encode the units in parallel, then join the parts of each type
+  const double t0 = Communicator::GetTime();
+  const int num_units = s.counts.size();
+  std::vector<int> unit_offset(num_units + 1, 0);
+  for (int u = 0; u < num_units; u++) {
+    unit_offset[u + 1] = unit_offset[u] + s.counts[u];
+  }
+  unit_data.resize(num_units);
+  #pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+  for (int u = 0; u < num_units; u++) {
+    EncodeUnit(s, u, unit_offset[u], num_types);
+  }
+  // Particle numbers, then byte sizes, of each type
+  std::vector<int64_t> sizes(2 * num_types + 1, 0);
+  for (int i = 0; i < pn; i++) {
+    sizes[s.records[i].type]++;
+  }
+  std::vector<std::vector<char> > type_data(num_types);
+  for (int t = 0; t < num_types; t++) {
+    for (int u = 0; u < num_units; u++) {
+      type_data[t].insert(type_data[t].end(), unit_data[u][t].begin(), unit_data[u][t].end());
+    }
+    sizes[num_types + t] = type_data[t].size();
+    encoded_bytes += type_data[t].size();
+  }
+  raw_bytes += 48.0 * pn;
+  encode_time += Communicator::GetTime() - t0;
+
+  std::vector<int64_t> offset, total;
+  Communicator::ScanCounts(sizes, offset, total, comm);
+
+  MPI_File fh;
+  if (MPI_File_open(comm, const_cast<char *>(filename.c_str()), MPI_MODE_CREATE | MPI_MODE_RDWR,
+                    MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+    return false;
+  }
+
+  TrajectoryFrameHeader fr;
+  memcpy(fr.magic, TrajectoryFile::FRAME_MAGIC, sizeof(fr.magic));
+  fr.frame = index.size();
+  fr.num_particles = 0;
+  int64_t bytes = 0;
+  for (int t = 0; t < num_types; t++) {
+    fr.num_particles += total[t];
+    bytes += total[num_types + t];
+  }
+  fr.num_types = num_types;
+  fr.codec = codec;
+  fr.time = s.time;
+  for (int d = 0; d < 3; d++) {
+    fr.L[d] = s.L[d];
+  }
+  const int64_t frame_offset = end_offset;
+  if (rank == 0) {
+    MPI_File_write_at(fh, frame_offset, &fr, sizeof(fr), MPI_BYTE, MPI_STATUS_IGNORE);
+    if (num_types > 0) {
+      MPI_File_write_at(fh, frame_offset + sizeof(fr), &total[0], sizeof(int64_t) * 2 * num_types,
+                        MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+  }
+  int64_t type_start = frame_offset + sizeof(fr) + sizeof(int64_t) * 2 * num_types;
+  for (int t = 0; t < num_types; t++) {
+    const MPI_Offset o = type_start + offset[num_types + t];
+    const int size = type_data[t].size();
+    MPI_File_write_at_all(fh, o, size ? &type_data[t][0] : NULL, size, MPI_BYTE, MPI_STATUS_IGNORE);
+    type_start += total[num_types + t];
+  }
+
+  TrajectoryIndexEntry e;
+  e.offset = frame_offset;
+  e.num_particles = fr.num_particles;
+  e.bytes = TrajectoryFile::FrameSize(num_types, bytes);
+  e.time = fr.time;
+  e.num_types = num_types;
+  e.codec = codec;
+  index.push_back(e);
+  end_offset = frame_offset + e.bytes;
+
+  // The header is written last, so that it never points to a partial frame
+  if (rank == 0) {
+    MPI_File_write_at(fh, end_offset, &index[0], sizeof(TrajectoryIndexEntry) * index.size(),
+                      MPI_BYTE, MPI_STATUS_IGNORE);
+    TrajectoryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TrajectoryFile::MAGIC, sizeof(header.magic));
+    header.version = TrajectoryFile::VERSION;
+    header.record_size = sizeof(TrajectoryRecord);
+    header.num_frames = index.size();
+    header.index_offset = end_offset;
+    header.end_offset = end_offset;
+    MPI_File_write_at(fh, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+  }
+  MPI_File_close(&fh);
+  return true;
+}
+//----------------------------------------------------------------------
@@ -0,0 +1,35 @@
+#!/bin/sh
+# usage: restart.sh mdacp [ThermostatOption ...]
+# A Nose-Hoover run stopped at step 150 and restarted must observe the
+# same times and temperatures as a run which never stopped. The stop is
+# made deterministic by a WallTimeMargin as long as the WallTime.
+B=$1; shift
+W=$(mktemp -d "${TMPDIR:-/tmp}/mdacp_restart.XXXXXX") || exit 1
+trap 'rm -rf "$W"' EXIT
+cat > "$W/base.cfg" <<EOF
+Mode=Benchmark
+Density=0.712
+SystemSize=12
+TimeStep=0.002
+ThermalizeLoop=0
+TotalLoop=400
+ObserveLoop=50
+InitialVelocity=0.9
+ControlTemperature=yes
+AimedTemperature=1.2
+Restart=yes
+EOF
+for o in "$@"; do echo "$o" >> "$W/base.cfg"; done
+mkdir "$W/full" "$W/stop"
+cp "$W/base.cfg" "$W/full/input.cfg"
+(cat "$W/base.cfg"; printf "WallTime=100\nWallTimeMargin=100\nStopCheckInterval=150\n") > "$W/stop/input.cfg"
+export OMP_NUM_THREADS=2
+(cd "$W/full" && "$B" > out.txt 2>&1) || exit 1
+(cd "$W/stop" && "$B" > out1.txt 2>&1) || exit 1
+grep -q "stopped at step 150" "$W/stop/out1.txt" || { echo "no stop"; exit 1; }
+cp "$W/base.cfg" "$W/stop/input.cfg"
+(cd "$W/stop" && "$B" > out2.txt 2>&1) || exit 1
+grep -q "Resumed at step 150" "$W/stop/out2.txt" || { echo "no resume"; exit 1; }
+grep "#observe" "$W/full/out.txt" | cut -d' ' -f1,2 > "$W/expected.txt"
+cat "$W/stop/out1.txt" "$W/stop/out2.txt" | grep "#observe" | cut -d' ' -f1,2 > "$W/actual.txt"
+diff "$W/expected.txt" "$W/actual.txt"
@@ -0,0 +1,329 @@
+//----------------------------------------------------------------------
+// mdacp_traj: random access to the binary trajectory container
+//
+//   mdacp_traj info   traj.mdt
+//   mdacp_traj cdview traj.mdt [-b begin] [-e end] [-s stride] [-t type] [-o prefix]
+//   mdacp_traj subsample traj.mdt out.mdt [-b begin] [-e end] [-s stride] [-t type]
+//
+// The file is memory-mapped, and only the frames selected are read.
+// Compressed frames are decoded; subsample copies them as they are.
+//----------------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <vector>
+#include <string>
+#include "cmdline.h"
+#include "trajectoryfile.h"
+#include "trajectorycodec.h"
+//----------------------------------------------------------------------
+class TrajectoryReader {
+private:
+  int fd;
+  const char *data;
+  int64_t size;
+  TrajectoryHeader header;
+  std::vector<TrajectoryIndexEntry> index;
+  bool LoadIndex(void);
+  void ScanFrames(void);
+public:
+  TrajectoryReader(void) : fd(-1), data(NULL), size(0) {};
+  ~TrajectoryReader(void);
+  bool Open(const char *filename);
+  int GetFrameNumber(void) {return index.size();};
+  const TrajectoryFrameHeader * GetFrame(int i);
+  const int64_t * GetTypeCounts(int i);
+  const int64_t * GetTypeBytes(int i) {return GetTypeCounts(i) + index[i].num_types;};
+  const char * GetTypeData(int i, int type);
+  void GetParticles(int i, int type, std::vector<TrajectoryParticle> &particles);
+};
+//----------------------------------------------------------------------
+TrajectoryReader::~TrajectoryReader(void) {
+  if (data != NULL) munmap(const_cast<char *>(data), size);
+  if (fd >= 0) close(fd);
+}
+//----------------------------------------------------------------------
+bool
+TrajectoryReader::Open(const char *filename) {
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(TrajectoryHeader))) return false;
+  size = st.st_size;
+  void *p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) return false;
+  data = static_cast<const char *>(p);
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, TrajectoryFile::MAGIC, sizeof(header.magic)) != 0) return false;
+  if (header.version != TrajectoryFile::VERSION) return false;
+  if (header.record_size != static_cast<int>(sizeof(TrajectoryRecord))) return false;
+  if (header.end_offset > size) header.end_offset = size;
+  if (!LoadIndex()) ScanFrames();
+  return true;
+}
+//----------------------------------------------------------------------
+// The index is only checked for bounds, so that no frame is touched
+//----------------------------------------------------------------------
+bool
+TrajectoryReader::LoadIndex(void) {
+  const int64_t bytes = header.num_frames * sizeof(TrajectoryIndexEntry);
+  if (header.num_frames < 0 || header.index_offset < header.end_offset) return false;
+  if (header.index_offset + bytes > size) return false;
+  index.resize(header.num_frames);
+  if (bytes > 0) memcpy(&index[0], data + header.index_offset, bytes);
+  for (unsigned int i = 0; i < index.size(); i++) {
+    const TrajectoryIndexEntry &e = index[i];
+    if (e.offset < static_cast<int64_t>(sizeof(TrajectoryHeader)) || e.num_types < 0
+        || e.bytes < TrajectoryFile::FrameSize(e.num_types, 0) || e.offset + e.bytes > header.end_offset) {
+      index.clear();
+      return false;
+    }
+  }
+  return true;
+}
+//----------------------------------------------------------------------
+// Without a valid index, the frames are found from their headers
+//----------------------------------------------------------------------
+void
+TrajectoryReader::ScanFrames(void) {
+  std::cerr << "# Index not found. Scanning the frames." << std::endl;
+  int64_t offset = sizeof(TrajectoryHeader);
+  while (offset + static_cast<int64_t>(sizeof(TrajectoryFrameHeader)) <= header.end_offset) {
+    const TrajectoryFrameHeader *fr = reinterpret_cast<const TrajectoryFrameHeader *>(data + offset);
+    if (memcmp(fr->magic, TrajectoryFile::FRAME_MAGIC, sizeof(fr->magic)) != 0) break;
+    if (fr->num_types < 0 || fr->num_types > TrajectoryFile::MAX_TYPES) break;
+    if (offset + TrajectoryFile::FrameSize(fr->num_types, 0) > header.end_offset) break;
+    const int64_t *bytes = reinterpret_cast<const int64_t *>(fr + 1) + fr->num_types;
+    int64_t data_bytes = 0;
+    for (int t = 0; t < fr->num_types; t++) {
+      data_bytes += bytes[t];
+    }
+    const int64_t frame_size = TrajectoryFile::FrameSize(fr->num_types, data_bytes);
+    if (offset + frame_size > header.end_offset) break;
+    TrajectoryIndexEntry e;
+    e.offset = offset;
+    e.num_particles = fr->num_particles;
+    e.bytes = frame_size;
+    e.time = fr->time;
+    e.num_types = fr->num_types;
+    e.codec = fr->codec;
+    index.push_back(e);
+    offset += frame_size;
+  }
+}
+//----------------------------------------------------------------------
+const TrajectoryFrameHeader *
+TrajectoryReader::GetFrame(int i) {
+  const TrajectoryFrameHeader *fr = reinterpret_cast<const TrajectoryFrameHeader *>(data + index[i].offset);
+  if (memcmp(fr->magic, TrajectoryFile::FRAME_MAGIC, sizeof(fr->magic)) != 0) return NULL;
+  return fr;
+}
+//----------------------------------------------------------------------
+const int64_t *
+TrajectoryReader::GetTypeCounts(int i) {
+  return reinterpret_cast<const int64_t *>(data + index[i].offset + sizeof(TrajectoryFrameHeader));
+}
+//----------------------------------------------------------------------
+const char *
+TrajectoryReader::GetTypeData(int i, int type) {
+  const int64_t *bytes = GetTypeBytes(i);
+  int64_t offset = index[i].offset + TrajectoryFile::FrameSize(index[i].num_types, 0);
+  for (int t = 0; t < type; t++) {
+    offset += bytes[t];
+  }
+  return data + offset;
+}
+//----------------------------------------------------------------------
+void
+TrajectoryReader::GetParticles(int i, int type, std::vector<TrajectoryParticle> &particles) {
+  particles.clear();
+  const int64_t n = GetTypeCounts(i)[type];
+  const char *p = GetTypeData(i, type);
+  if (index[i].codec == TrajectoryCodec::RAW) {
+    const TrajectoryRecord *r = reinterpret_cast<const TrajectoryRecord *>(p);
+    for (int64_t j = 0; j < n; j++) {
+      TrajectoryParticle tp;
+      for (int d = 0; d < 3; d++) {
+        tp.q[d] = r[j].q[d];
+        tp.p[d] = r[j].p[d];
+      }
+      particles.push_back(tp);
+    }
+    return;
+  }
+  while (static_cast<int64_t>(particles.size()) < n) {
+    const int64_t bytes = TrajectoryCodec::Decode(index[i].codec, p, particles);
+    if (bytes <= 0) break;
+    p += bytes;
+  }
+}
+//----------------------------------------------------------------------
+struct Selection {
+  int begin;
+  int end;
+  int stride;
+  int type;
+  bool HasType(int t) {return type < 0 || type == t;};
+};
+//----------------------------------------------------------------------
+void
+ShowInfo(TrajectoryReader &tr) {
+  std::cout << "# " << tr.GetFrameNumber() << " frame(s)" << std::endl;
+  std::cout << "# frame time N L[X] L[Y] L[Z] codec bytes N(type)..." << std::endl;
+  for (int i = 0; i < tr.GetFrameNumber(); i++) {
+    const TrajectoryFrameHeader *fr = tr.GetFrame(i);
+    if (fr == NULL) {
+      std::cerr << "Broken frame " << i << std::endl;
+      return;
+    }
+    const int64_t *counts = tr.GetTypeCounts(i);
+    std::cout << fr->frame << " " << fr->time << " " << fr->num_particles;
+    std::cout << " " << fr->L[0] << " " << fr->L[1] << " " << fr->L[2];
+    std::cout << " " << TrajectoryCodec::GetName(fr->codec);
+    int64_t bytes = 0;
+    for (int t = 0; t < fr->num_types; t++) {
+      bytes += tr.GetTypeBytes(i)[t];
+    }
+    std::cout << " " << bytes;
+    for (int t = 0; t < fr->num_types; t++) {
+      std::cout << " " << counts[t];
+    }
+    std::cout << std::endl;
+  }
+}
+//----------------------------------------------------------------------
+// Same text layout as MDManager::SaveAsCdview
+//----------------------------------------------------------------------
+bool
+SaveAsCdview(TrajectoryReader &tr, int i, Selection &sel, const char *filename) {
+  const TrajectoryFrameHeader *fr = tr.GetFrame(i);
+  if (fr == NULL) return false;
+  FILE *fp = fopen(filename, "w");
+  if (fp == NULL) return false;
+  std::vector<TrajectoryParticle> particles;
+  for (int t = 0; t < fr->num_types; t++) {
+    if (!sel.HasType(t)) continue;
+    tr.GetParticles(i, t, particles);
+    for (unsigned int j = 0; j < particles.size(); j++) {
+      const TrajectoryParticle &r = particles[j];
+      fprintf(fp, "0 %d %g %g %g %g %g %g\n", t, r.q[0], r.q[1], r.q[2], r.p[0], r.p[1], r.p[2]);
+    }
+  }
+  fclose(fp);
+  return true;
+}
+//----------------------------------------------------------------------
+// Writes the selected frames (and types) as a new container
+//----------------------------------------------------------------------
+bool
+Subsample(TrajectoryReader &tr, Selection &sel, const char *filename) {
+  FILE *fp = fopen(filename, "wb");
+  if (fp == NULL) return false;
+  TrajectoryHeader header;
+  memset(&header, 0, sizeof(header));
+  fwrite(&header, sizeof(header), 1, fp);
+  std::vector<TrajectoryIndexEntry> index;
+  int64_t offset = sizeof(header);
+  for (int i = sel.begin; i < sel.end; i += sel.stride) {
+    const TrajectoryFrameHeader *src = tr.GetFrame(i);
+    if (src == NULL) break;
+    const int num_types = src->num_types;
+    TrajectoryFrameHeader fr = *src;
+    fr.frame = index.size();
+    // Particle numbers, then byte sizes
+    std::vector<int64_t> sizes(tr.GetTypeCounts(i), tr.GetTypeCounts(i) + 2 * num_types);
+    fr.num_particles = 0;
+    int64_t bytes = 0;
+    for (int t = 0; t < num_types; t++) {
+      if (!sel.HasType(t)) {
+        sizes[t] = 0;
+        sizes[num_types + t] = 0;
+      }
+      fr.num_particles += sizes[t];
+      bytes += sizes[num_types + t];
+    }
+    fwrite(&fr, sizeof(fr), 1, fp);
+    if (num_types > 0) fwrite(&sizes[0], sizeof(int64_t), 2 * num_types, fp);
+    for (int t = 0; t < num_types; t++) {
+      if (sizes[num_types + t] > 0) fwrite(tr.GetTypeData(i, t), 1, sizes[num_types + t], fp);
+    }
+    TrajectoryIndexEntry e;
+    e.offset = offset;
+    e.num_particles = fr.num_particles;
+    e.bytes = TrajectoryFile::FrameSize(num_types, bytes);
+    e.time = fr.time;
+    e.num_types = num_types;
+    e.codec = fr.codec;
+    index.push_back(e);
+    offset += e.bytes;
+  }
+  if (!index.empty()) fwrite(&index[0], sizeof(TrajectoryIndexEntry), index.size(), fp);
+  memcpy(header.magic, TrajectoryFile::MAGIC, sizeof(header.magic));
+  header.version = TrajectoryFile::VERSION;
+  header.record_size = sizeof(TrajectoryRecord);
+  header.num_frames = index.size();
+  header.index_offset = offset;
+  header.end_offset = offset;
+  fseek(fp, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, fp);
+  fclose(fp);
+  std::cerr << "# " << index.size() << " frame(s) written to " << filename << std::endl;
+  return true;
+}
+//----------------------------------------------------------------------
+int
+main(int argc, char **argv) {
+  cmdline::parser a;
+  a.add<int>("begin", 'b', "first frame", false, 0);
+  a.add<int>("end", 'e', "last frame + 1 (default: all)", false, -1);
+  a.add<int>("stride", 's', "frame stride", false, 1, cmdline::range(1, 1 << 30));
+  a.add<int>("type", 't', "particle type (default: all)", false, -1);
+  a.add<std::string>("prefix", 'o', "prefix of the cdview files", false, "conf");
+  a.footer("info|cdview|subsample trajectory [output]");
+  a.parse_check(argc, argv);
+  const std::vector<std::string> &rest = a.rest();
+  if (rest.size() < 2) {
+    std::cerr << a.usage();
+    return 1;
+  }
+  const std::string command = rest[0];
+  TrajectoryReader tr;
+  if (!tr.Open(rest[1].c_str())) {
+    std::cerr << "Cannot read the trajectory " << rest[1] << std::endl;
+    return 1;
+  }
+  Selection sel;
+  sel.begin = std::max(a.get<int>("begin"), 0);
+  sel.end = a.get<int>("end");
+  if (sel.end < 0 || sel.end > tr.GetFrameNumber()) sel.end = tr.GetFrameNumber();
+  sel.stride = a.get<int>("stride");
+  sel.type = a.get<int>("type");
+
+  if (command == "info") {
+    ShowInfo(tr);
+  } else if (command == "cdview") {
+    const std::string prefix = a.get<std::string>("prefix");
+    for (int i = sel.begin; i < sel.end; i += sel.stride) {
+      char filename[256];
+      snprintf(filename, sizeof(filename), "%s%04d.cd", prefix.c_str(), i);
+      if (!SaveAsCdview(tr, i, sel, filename)) {
+        std::cerr << "Cannot write frame " << i << " to " << filename << std::endl;
+        return 1;
+      }
+    }
+  } else if (command == "subsample") {
+    if (rest.size() < 3 || !Subsample(tr, sel, rest[2].c_str())) {
+      std::cerr << "Cannot write the subsampled trajectory" << std::endl;
+      return 1;
+    }
+  } else {
+    std::cerr << a.usage();
+    return 1;
+  }
+  return 0;
+}
+//----------------------------------------------------------------------